@@ -0,0 +1,267 @@
+#! /usr/bin/perl -w
+
+# bench.pl
+#    This program benchmarks the io61 and stdio versions of the tests
+#    over a matrix of file sizes, block sizes and strides, with warm and
+#    cold page caches. Each configuration runs several trials; the
+#    report gives the median, 95th percentile, mean with a 95% confidence
+#    interval, and (if `strace` is installed) system calls per megabyte.
+#    Output is CSV on standard output, or JSON with `-f json`.
+#
+#    Usage: perl bench.pl [-n TRIALS] [-f csv|json] [-o FILE]
+#                         [-c warm|cold|both] [-q] [PROGRAM...]
+#    `-q` runs a reduced matrix. PROGRAM arguments (e.g. `cat61`)
+#    restrict the run to those tests.
+
+use Time::HiRes;
+use POSIX;
+use Getopt::Std;
+use FindBin;
+use lib $FindBin::Bin;
+use files61;
+
+my(%opt);
+getopts("n:f:o:c:q", \%opt) or die "Usage: perl bench.pl [-n TRIALS] [-f csv|json] [-o FILE] [-c warm|cold|both] [-q] [PROGRAM...]\n";
+my($TRIALS) = exists($opt{"n"}) ? int($opt{"n"}) : 5;
+$TRIALS = 5 if $TRIALS <= 0;
+my($FORMAT) = exists($opt{"f"}) ? $opt{"f"} : "csv";
+die "bench.pl: unknown format $FORMAT\n" if $FORMAT ne "csv" && $FORMAT ne "json";
+my(@CACHES) = !exists($opt{"c"}) || $opt{"c"} eq "both" ? ("warm", "cold") : ($opt{"c"});
+my($QUICK) = exists($opt{"q"});
+my($MAXTIME) = exists($ENV{"MAXTIME"}) ? $ENV{"MAXTIME"} + 0 : 60;
+my($STRACE) = (grep {-x $_} ("/usr/bin/strace", "/bin/strace"))[0];
+
+
+# run_trial($command)
+#    Run `$command` and return a hash of its profile61 report (read from
+#    file descriptor 100), plus the wall-clock "time". Returns undef if
+#    the command fails or runs longer than $MAXTIME seconds.
+sub run_trial ($) {
+    my($command) = @_;
+    pipe(PR, PW);
+    my($before) = Time::HiRes::time();
+    my($pid) = fork();
+    if ($pid == 0) {
+        setpgrp(0, 0);
+        close(PR);
+        POSIX::dup2(fileno(PW), 100);
+        close(PW);
+        open(STDOUT, ">", "/dev/null");
+        { exec($command) };
+        exit(1);
+    }
+    close(PW);
+    my($status);
+    while (($status = waitpid($pid, WNOHANG)) == 0
+           && Time::HiRes::time() < $before + $MAXTIME) {
+        Time::HiRes::usleep(1000);
+    }
+    my($delta) = Time::HiRes::time() - $before;
+    if ($status == 0) {
+        kill 9, -$pid;
+        waitpid($pid, 0);
+        close(PR);
+        return undef;
+    }
+    my($ok) = $? == 0;
+    my($buf, $t) = ("", {});
+    POSIX::read(fileno(PR), $buf, 2000);
+    close(PR);
+    while ($buf =~ m,\"(.*?)\"\s*:\s*([\d.]+),g) {
+        $t->{$1} = $2 + 0;
+    }
+    $t->{"time"} = $delta if !exists($t->{"time"}) || $t->{"time"} <= 0;
+    return $ok ? $t : undef;
+}
+
+# syscalls_per_mb($command, $insize)
+#    Count the system calls `$command` makes with `strace -c`, per
+#    megabyte of input. Returns undef if strace is unavailable.
+sub syscalls_per_mb ($$) {
+    my($command, $insize) = @_;
+    return undef if !$STRACE || !$insize;
+    my($log) = "files/bench-strace.txt";
+    unlink($log);
+    system("$STRACE -f -c -o $log sh -c '$command' >/dev/null 2>&1 100>/dev/null");
+    my($calls, $callsend);
+    if (open(STRACELOG, "<", $log)) {
+        # Columns are right-aligned under the header; take the number
+        # that ends where the "calls" heading ends
+        while (defined($_ = <STRACELOG>)) {
+            $callsend = $+[0] if /\bcalls\b/ && !defined($callsend);
+            $calls = $1 if defined($callsend) && /total$/
+                && substr($_, 0, $callsend) =~ /(\d+)$/;
+        }
+        close(STRACELOG);
+    }
+    unlink($log);
+    return defined($calls) ? $calls / ($insize / (1 << 20)) : undef;
+}
+
+# Two-sided 95% Student's t critical values, indexed by degrees of freedom
+my(@TCRIT) = (0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306,
+              2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120,
+              2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064,
+              2.060, 2.056, 2.052, 2.048, 2.045, 2.042);
+
+# summarize(@times)
+#    Return median, 95th percentile (nearest rank), mean, and the bounds
+#    of the 95% confidence interval of the mean.
+sub summarize (@) {
+    my(@x) = sort { $a <=> $b } @_;
+    my($n) = scalar(@x);
+    my($median) = $n % 2 ? $x[$n / 2] : ($x[$n / 2 - 1] + $x[$n / 2]) / 2;
+    my($p95) = $x[POSIX::ceil(0.95 * $n) - 1];
+    my($mean) = 0;
+    $mean += $_ foreach @x;
+    $mean /= $n;
+    my($var) = 0;
+    $var += ($_ - $mean) ** 2 foreach @x;
+    my($half) = 0;
+    if ($n > 1) {
+        $var /= $n - 1;
+        $half = ($n - 1 < @TCRIT ? $TCRIT[$n - 1] : 1.960) * sqrt($var / $n);
+    }
+    return ($median, $p95, $mean, $mean - $half, $mean + $half);
+}
+
+
+# The benchmark matrix. Each entry names a test and says which
+# parameters it sweeps; `%b`, `%t`, `%i` in the command are replaced by
+# the block size, stride and input file. Tests marked "nofile" take no
+# input file and run once per implementation.
+my(@SIZES) = $QUICK ? (1 << 20) : (1 << 20, 5 << 20, 20 << 20);
+my(@BLOCKS) = $QUICK ? (1, 4096) : (1, 64, 512, 4096, 65536);
+my(@STRIDES) = $QUICK ? (2, 1048576) : (2, 4096, 1048576);
+my(@matrix) = (
+    {"program" => "cat61", "command" => "./cat61 -o files/out.txt %i"},
+    {"program" => "blockcat61", "blocks" => 1,
+     "command" => "./blockcat61 -b %b -o files/out.txt %i"},
+    {"program" => "randblockcat61", "blocks" => 1,
+     "command" => "./randblockcat61 -b %b -o files/out.txt %i"},
+    {"program" => "gather61", "blocks" => 1,
+     "command" => "./gather61 -b %b -o files/out.txt %i %i"},
+    {"program" => "scatter61", "blocks" => 1,
+     "command" => "./scatter61 -b %b files/out1.txt files/out2.txt files/out3.txt < %i"},
+    {"program" => "reverse61", "command" => "./reverse61 -o files/out.txt %i"},
+    {"program" => "reordercat61", "blocks" => 1,
+     "command" => "./reordercat61 -b %b -o files/out.txt %i"},
+    {"program" => "stridecat61", "blocks" => 1, "strides" => 1,
+     "command" => "./stridecat61 -b %b -t %t -o files/out.txt %i"},
+    {"program" => "ostridecat61", "blocks" => 1, "strides" => 1,
+     "command" => "./ostridecat61 -b %b -t %t -o files/out.txt %i"},
+    {"program" => "linecat61", "command" => "./linecat61 -o files/out.txt %i"},
+    {"program" => "pipeexchange61", "nofile" => 1,
+     "command" => "./pipeexchange61"}
+);
+if (@ARGV) {
+    my(%want) = map { $_ => 1 } @ARGV;
+    @matrix = grep { $want{$_->{"program"}} } @matrix;
+}
+
+
+if (!-d "files" && !mkdir("files")) {
+    die "bench.pl: cannot create 'files'\n";
+}
+my(%sizefile) = ((1 << 20) => "files/text1meg.txt",
+                 (5 << 20) => "files/text5meg.txt",
+                 (20 << 20) => "files/text20meg.txt");
+foreach my $size (@SIZES) {
+    makefile($sizefile{$size}, $size);
+}
+
+my(@results);
+foreach my $m (@matrix) {
+    my(@configs);
+    foreach my $size ($m->{"nofile"} ? (0) : @SIZES) {
+        foreach my $b ($m->{"blocks"} ? @BLOCKS : ("")) {
+            foreach my $t ($m->{"strides"} ? @STRIDES : ("")) {
+                push @configs, [$size, $b, $t];
+            }
+        }
+    }
+
+    foreach my $c (@configs) {
+        my($size, $b, $t) = @$c;
+        my($infile) = $size ? $sizefile{$size} : "";
+        my($command) = $m->{"command"};
+        $command =~ s/%b/$b/g;
+        $command =~ s/%t/$t/g;
+        $command =~ s/%i/$infile/g;
+        my($insize) = $size * ($command =~ /gather61/ ? 2 : 1);
+
+        foreach my $cache ($m->{"nofile"} ? ("warm") : @CACHES) {
+            my(%median);
+            foreach my $impl ("stdio", "io61") {
+                my($cmd) = $command;
+                $cmd =~ s<(\./)([a-z]*61)><${1}stdio-$2>g if $impl eq "stdio";
+                run_trial($cmd) if $cache eq "warm" && $infile;
+                my(@times, @trials);
+                for (my $i = 0; $i < $TRIALS; ++$i) {
+                    decache($infile) if $cache eq "cold" && $infile;
+                    my($r) = run_trial($cmd);
+                    last if !$r;
+                    push @times, $r->{"time"};
+                    push @trials, $r;
+                }
+                my($r) = {"program" => $m->{"program"}, "impl" => $impl,
+                          "command" => $cmd, "size" => $size,
+                          "block" => $b, "stride" => $t, "cache" => $cache,
+                          "trials" => scalar(@times)};
+                if (@times) {
+                    @$r{"median", "p95", "mean", "ci95_lo", "ci95_hi"} =
+                        summarize(@times);
+                    my(@utimes) = map { $_->{"utime"} || 0 } @trials;
+                    my(@stimes) = map { $_->{"stime"} || 0 } @trials;
+                    $r->{"utime"} = (summarize(@utimes))[0];
+                    $r->{"stime"} = (summarize(@stimes))[0];
+                    $median{$impl} = $r->{"median"};
+                }
+                $r->{"syscalls_per_mb"} = syscalls_per_mb($cmd, $insize)
+                    if $cache eq "warm";
+                if ($impl eq "io61" && $median{"io61"} && $median{"stdio"}) {
+                    $r->{"speedup"} = $median{"stdio"} / $median{"io61"};
+                }
+                push @results, $r;
+                print STDERR sprintf("%-60s %-5s %-4s %s\n", $cmd, $cache,
+                                     $impl, @times ? sprintf("%.5fs", $r->{"median"}) : "FAILED");
+            }
+        }
+    }
+}
+
+
+my(@COLUMNS) = ("program", "impl", "size", "block", "stride", "cache",
+                "trials", "median", "p95", "mean", "ci95_lo", "ci95_hi",
+                "utime", "stime", "syscalls_per_mb", "speedup", "command");
+my($out) = \*STDOUT;
+if (exists($opt{"o"})) {
+    open(BENCHOUT, ">", $opt{"o"}) or die "$opt{o}: $!\n";
+    $out = \*BENCHOUT;
+}
+sub fmt ($) {
+    my($v) = @_;
+    return $v =~ /^-?\d+$/ ? $v : sprintf("%.6g", $v);
+}
+if ($FORMAT eq "csv") {
+    print $out join(",", @COLUMNS), "\n";
+    foreach my $r (@results) {
+        print $out join(",", map {
+            !defined($r->{$_}) || $r->{$_} eq "" ? ""
+                : $_ eq "command" ? "\"$r->{$_}\""
+                : $_ =~ /^(program|impl|cache)$/ ? $r->{$_}
+                : fmt($r->{$_})
+        } @COLUMNS), "\n";
+    }
+} else {
+    my(@rows);
+    foreach my $r (@results) {
+        push @rows, "  {" . join(", ", map {
+            "\"$_\": " . (!defined($r->{$_}) || $r->{$_} eq "" ? "null"
+                          : $_ =~ /^(program|impl|cache|command)$/ ? "\"$r->{$_}\""
+                          : fmt($r->{$_}))
+        } @COLUMNS) . "}";
+    }
+    print $out "[\n", join(",\n", @rows), "\n]\n";
+}
+close(BENCHOUT) if exists($opt{"o"});
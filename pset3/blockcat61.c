@@ -1,12 +1,13 @@
 #include "io61.h"
 
-// Usage: ./blockcat61 [-b BLOCKSIZE] [-o OUTFILE] [FILE]
+// Usage: ./blockcat61 [-b BLOCKSIZE] [-o OUTFILE] [-z] [FILE]
 //    Copies the input FILE to standard output in blocks.
-//    Default BLOCKSIZE is 4096.
+//    Default BLOCKSIZE is 4096. With -z, copies with `io61_copy`,
+//    turning runs of zeros into holes in OUTFILE.
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_arguments args = io61_parse_arguments(argc, argv, "b:o:");
+    io61_arguments args = io61_parse_arguments(argc, argv, "b:o:z");
     size_t block_size = args.block_size ? args.block_size : 4096;
 
     // Allocate buffer, open files
@@ -18,7 +19,9 @@ int main(int argc, char* argv[]) {
                                       O_WRONLY | O_CREAT | O_TRUNC);
 
     // Copy file data
-    while (1) {
+    if (args.sparse)
+        io61_copy(inf, outf, IO61_COPY_SPARSE);
+    while (!args.sparse) {
         ssize_t amount = io61_read(inf, buf, block_size);
         if (amount <= 0)
             break;
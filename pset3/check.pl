@@ -9,15 +9,22 @@
 #
 #    To add tests of your own, scroll down to the bottom. It should
 #    be relatively clear what to do.
+#
+#    Set IO61_PERF=1 to collect hardware performance counters (see
+#    profile61.c); each test then reports them on a COUNTERS line.
 
 use Time::HiRes qw(gettimeofday);
 use Fcntl qw(F_GETFL F_SETFL O_NONBLOCK);
 use POSIX;
 use Scalar::Util qw(looks_like_number);
 use List::Util qw(shuffle);
+use FindBin;
+use lib $FindBin::Bin;
+use files61;
 my($nkilled) = 0;
 my($nerror) = 0;
 my(@ratios, @runtimes, @basetimes, @alltests);
+my(%boundcounts);
 my(%fileinfo);
 my($NOSTDIO) = exists($ENV{"NOSTDIO"});
 my($NOYOURCODE) = exists($ENV{"NOYOURCODE"});
@@ -34,7 +41,6 @@ my($CHECKSUM) = first(grep {-x $_} ("/usr/bin/md5sum", "/sbin/md5",
                                     "/bin/false"));
 my($VERBOSE) = exists($ENV{"VERBOSE"});
 my($NOMAKE) = exists($ENV{"NOMAKE"}) && int($ENV{"NOMAKE"});
-eval { require "syscall.ph" };
 
 my($Red, $Redctx, $Green, $Cyan, $Off) = ("\x1b[01;31m", "\x1b[0;31m", "\x1b[01;32m", "\x1b[01;36m", "\x1b[0m");
 $Red = $Redctx = $Green = $Cyan = $Off = "" if !-t STDERR || !-t STDOUT;
@@ -43,31 +49,37 @@ $Red = $Redctx = $Green = $Cyan = $Off = "" if !-t STDERR || !-t STDOUT;
 $SIG{"CHLD"} = sub {};
 my($run61_pid);
 
-sub decache ($) {
-    my($fn) = @_;
-    if (defined(&{"SYS_fadvise64"}) && open(DECACHE, "<", $fn)) {
-        syscall &SYS_fadvise64, fileno(DECACHE), 0, -s DECACHE, 4;
-        close(DECACHE);
-    }
+sub maketextfile ($$) {
+    my($filename, $size) = @_;
+    makefile($filename, $size);
+    $fileinfo{$filename} = [-M $filename, -C $filename, $size];
 }
 
-sub makefile ($$) {
+sub makebinaryfile ($$) {
     my($filename, $size) = @_;
     if (!-r $filename || !defined(-s $filename) || -s $filename != $size) {
         while (!defined(-s $filename) || -s $filename < $size) {
-            system("cat /usr/share/dict/words >> $filename");
+            system("cat /bin/sh >> $filename");
         }
         truncate($filename, $size);
     }
     $fileinfo{$filename} = [-M $filename, -C $filename, $size];
 }
 
-sub makebinaryfile ($$) {
+sub makesparsefile ($$) {
     my($filename, $size) = @_;
     if (!-r $filename || !defined(-s $filename) || -s $filename != $size) {
-        while (!defined(-s $filename) || -s $filename < $size) {
-            system("cat /bin/sh >> $filename");
+        # 4KB of /bin/sh at the start of every megabyte; holes elsewhere
+        open(SPARSE, ">", $filename) or die "$filename: $!\n";
+        open(SH, "<", "/bin/sh") or die "/bin/sh: $!\n";
+        my($data) = "";
+        read(SH, $data, 4096);
+        close(SH);
+        for (my $off = 0; $off < $size; $off += 1 << 20) {
+            seek(SPARSE, $off, 0);
+            print SPARSE $data;
         }
+        close(SPARSE);
         truncate($filename, $size);
     }
     $fileinfo{$filename} = [-M $filename, -C $filename, $size];
@@ -79,10 +91,12 @@ sub verify_file ($) {
         && ($fileinfo{$filename}->[0] != -M $filename
             || $fileinfo{$filename}->[1] != -C $filename)) {
         truncate($filename, 0);
-        if ($filename =~ /^binary/) {
+        if ($filename =~ /sparse/) {
+            makesparsefile($filename, $fileinfo{$filename}->[2]);
+        } elsif ($filename =~ /^binary/) {
             makebinaryfile($filename, $fileinfo{$filename}->[2]);
         } else {
-            makefile($filename, $fileinfo{$filename}->[2]);
+            maketextfile($filename, $fileinfo{$filename}->[2]);
         }
     }
     return -s $filename;
@@ -469,6 +483,39 @@ sub print_stdio ($) {
     }
 }
 
+# print_counters($t)
+#    Print the performance counters of test result `$t`, if any, with a
+#    guess at what limits its speed: mostly system time means system
+#    calls; more than 10 cache misses per 1000 instructions means memory;
+#    anything else is copying or computation in user space.
+sub print_counters ($) {
+    my($t) = @_;
+    my(@parts);
+    push @parts, sprintf("%.1fM cycles", $t->{"cycles"} / 1e6)
+        if exists($t->{"cycles"});
+    push @parts, sprintf("%.1fM instructions", $t->{"instructions"} / 1e6)
+        if exists($t->{"instructions"});
+    push @parts, sprintf("%.2f IPC", $t->{"instructions"} / $t->{"cycles"})
+        if exists($t->{"instructions"}) && $t->{"cycles"};
+    push @parts, sprintf("%.1fK cache misses", $t->{"cachemisses"} / 1e3)
+        if exists($t->{"cachemisses"});
+    push @parts, pl($t->{"pagefaults"}, "page fault")
+        if exists($t->{"pagefaults"});
+    push @parts, $t->{"ctxswitches"} . " context switch"
+        . ($t->{"ctxswitches"} == 1 ? "" : "es")
+        if exists($t->{"ctxswitches"});
+    return if !@parts;
+    my($bound) = "copy-bound";
+    if ($t->{"stime"} > $t->{"utime"}) {
+        $bound = "syscall-bound";
+    } elsif ($t->{"instructions"} && exists($t->{"cachemisses"})
+             && $t->{"cachemisses"} * 1000 / $t->{"instructions"} > 10) {
+        $bound = "cache-miss-bound";
+    }
+    $boundcounts{$bound} += 1;
+    print "COUNTERS:  ", join(", ", @parts), " ($bound)\n";
+}
+
 sub run ($) {
     my($sequentially) = @_;
     my($number, $type) = (0, undef);
@@ -540,6 +587,7 @@ sub run ($) {
                $tt->{"time"}, $tt->{"utime"}, $tt->{"stime"}, $tt->{"maxrss"},
                $tt->{"medianof"}, $tt->{"medianof"} == 1 ? "" : "s");
             push @runtimes, $tt->{"time"};
+            print_counters($tt);
         }
 
         # print stdio vs. yourcode comparison
@@ -609,6 +657,12 @@ sub summary () {
         printf "           total time %.3f your code\n", $runtime;
     }
 
+    if (%boundcounts) {
+        print "           ", join(", ", map {
+            "$_ " . pl($boundcounts{$_}, "time")
+        } sort(keys %boundcounts)), "\n";
+    }
+
     if ($VERBOSE || $MAKETRIALLOG) {
         my(@testjsons);
         foreach my $t (@alltests) {
@@ -638,10 +692,11 @@ if (!-d "files" && (-e "files" || !mkdir("files"))) {
     print STDERR "*** Remove 'files' and try again.\n";
     exit(1);
 }
-makefile("files/text1meg.txt", 1 << 20);
+maketextfile("files/text1meg.txt", 1 << 20);
 makebinaryfile("files/binary1meg.bin", 1 << 20);
-makefile("files/text5meg.txt", 5 << 20);
-makefile("files/text20meg.txt", 20 << 20);
+maketextfile("files/text5meg.txt", 5 << 20);
+maketextfile("files/text20meg.txt", 20 << 20);
+makesparsefile("files/sparse20meg.bin", 20 << 20);
 
 $SIG{"INT"} = sub {
     kill 9, -$run61_pid if $run61_pid;
@@ -793,6 +848,124 @@ enqueue(28,
     "redirected large file, 1B-4KB block I/O, sequential");
 
 
+# LINE-ORIENTED I/O
+
+enqueue(29,
+    "./linecat61 -o files/out.txt files/text20meg.txt",
+    "regular large file, line I/O, sequential");
+
+enqueue(30,
+    "cat files/text20meg.txt | ./linecat61 | cat > files/out.txt",
+    "piped large file, line I/O, sequential");
+
+enqueue(31,
+    "./linecat61 -b 7 -o files/out.bin files/binary1meg.bin",
+    "regular small binary file, line I/O, 7B maximum line");
+
+
+# SPARSE FILES
+
+enqueue(32,
+    "./blockcat61 -z -o files/out.bin files/sparse20meg.bin",
+    "regular large sparse file, hole-preserving copy");
+
+enqueue(33,
+    "cat files/sparse20meg.bin | ./blockcat61 -z -o files/out.bin",
+    "piped large sparse file, hole-preserving copy");
+
+
+
+# FIXED-SIZE RECORDS
+
+enqueue(34,
+    "./recordcat61 -o files/out.bin files/binary1meg.bin",
+    "regular small binary file, 100B record I/O, sequential");
+
+enqueue(35,
+    "cat files/text20meg.txt | ./recordcat61 -b 4000 | cat > files/out.txt",
+    "piped large file, 4000B record I/O, sequential");
+
+enqueue(36,
+    "./recordcat61 -b 10007 -o files/out.txt files/text5meg.txt",
+    "regular medium file, 10007B record I/O, sequential");
+
+
+# WRITE-BEHIND OUTPUT
+
+enqueue(37,
+    "./wbcat61 -o files/out.txt files/text20meg.txt",
+    "regular large file, 4KB block I/O, write-behind output");
+
+enqueue(38,
+    "cat files/text5meg.txt | ./wbcat61 -b 1000 | cat > files/out.txt",
+    "piped medium file, 1000B block I/O, write-behind output");
+
+
+# SHARED OUTPUT FROM MANY THREADS
+
+enqueue(39,
+    "./threadlog61 -o files/out.txt",
+    "8 threads appending records to one thread-safe file");
+
+
+# CHECKSUMS
+
+enqueue(40,
+    "./cksum61 -b 1000 -o files/out.txt files/text20meg.txt files/binary1meg.bin",
+    "CRC32C of two files, 1000B block I/O");
+
+enqueue(41,
+    "env IO61_CRC32C_TABLE=1 ./cksum61 -b 1000 -o files/out.txt files/text20meg.txt files/binary1meg.bin",
+    "CRC32C of two files, 1000B block I/O, table-driven");
+
+
+# COMPRESSED FILES
+
+enqueue(42,
+    "./zseek61 -o files/out.txt files/text20meg.txt",
+    "compressed large file, 4KB block I/O, sequential then random seeks");
+
+enqueue(43,
+    "./zseek61 -b 777 -r 6582 -o files/out.bin files/binary1meg.bin",
+    "compressed small binary file, 777B block I/O, sequential then random seeks");
+
+
+# NONBLOCKING PIPES
+
+enqueue(44,
+    "cat files/text20meg.txt | ./nbcat61 | cat > files/out.txt",
+    "piped large file, 4KB block I/O, nonblocking with poll");
+
+enqueue(45,
+    "./nbcat61 -b 1000 files/text5meg.txt | (sleep 0.5; cat) > files/out.txt",
+    "medium file to stalled pipe, 1000B block I/O, nonblocking with poll");
+
+
+# STDIO STREAMS OVER IO61
+
+enqueue(46,
+    "./fprintf61 -o files/out.txt files/text20meg.txt",
+    "regular large file, fprintf through io61_fstream, numbered lines");
+
+enqueue(47,
+    "cat files/text5meg.txt | ./fprintf61 -b 7 | cat > files/out.txt",
+    "piped medium file, fprintf through io61_fstream, 7B maximum line");
+
+
+# COPYING AND TEEING
+
+enqueue(48,
+    "cat files/text20meg.txt | ./tee61 files/out.txt",
+    "piped large file, io61_copy to one file");
+
+enqueue(49,
+    "cat files/text20meg.txt | ./tee61 files/out1.txt files/out2.txt files/out3.txt",
+    "piped large file, io61_tee to three files");
+
+enqueue(50,
+    "./tee61 files/out1.txt files/out2.txt < files/binary1meg.bin",
+    "regular small binary file, io61_tee to two files");
+
 run($sequentially);
 
 summary();
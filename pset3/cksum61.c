@@ -0,0 +1,56 @@
+#include "io61.h"
+
+// Usage: ./cksum61 [-b BLOCKSIZE] [-o OUTFILE] [FILE...]
+//    Prints the CRC32C checksum and size of each FILE, read in blocks,
+//    to OUTFILE, one line per file. First checks that writing the
+//    standard test vector "123456789" yields the known CRC32C E3069283,
+//    and reports a failure in OUTFILE if it does not.
+//    Default BLOCKSIZE is 4096.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args = io61_parse_arguments(argc, argv, "b:o:#");
+    size_t block_size = args.block_size ? args.block_size : 4096;
+
+    // Allocate buffer, open files
+    char* buf = (char*) malloc(block_size > 256 ? block_size : 256);
+
+    io61_profile_begin();
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+
+    // Check the known answer
+    io61_file* nullf = io61_open_check("/dev/null", O_WRONLY);
+    io61_set_checksum(nullf);
+    io61_write(nullf, "123456789", 9);
+    uint32_t crc = io61_checksum(nullf);
+    io61_close(nullf);
+    if (crc != 0xE3069283) {
+        size_t n = sprintf(buf, "CRC32C(\"123456789\") = %08X, expected "
+                           "E3069283\n", (unsigned) crc);
+        io61_write(outf, buf, n);
+        fprintf(stderr, "cksum61: %s", buf);
+    }
+
+    // Checksum each input
+    for (int i = 0; i < args.n_input_files; ++i) {
+        const char* fname = args.input_files[i];
+        io61_file* inf = io61_open_check(fname, O_RDONLY);
+        io61_set_checksum(inf);
+        size_t size = 0;
+        while (1) {
+            ssize_t amount = io61_read(inf, buf, block_size);
+            if (amount <= 0)
+                break;
+            size += amount;
+        }
+        size_t n = sprintf(buf, "%08X %zu %s\n", (unsigned) io61_checksum(inf),
+                           size, fname ? fname : "-");
+        io61_write(outf, buf, n);
+        io61_close(inf);
+    }
+
+    io61_close(outf);
+    io61_profile_end();
+    free(buf);
+}
@@ -0,0 +1,31 @@
+# files61.pm
+#    Helpers shared by check.pl and bench.pl for creating test input
+#    files and dropping them from the page cache.
+
+eval { require "syscall.ph" };
+
+# decache($fn)
+#    Ask the kernel to drop file `$fn` from the page cache, so the next
+#    test that reads it starts cold.
+sub decache ($) {
+    my($fn) = @_;
+    if (defined(&{"SYS_fadvise64"}) && open(DECACHE, "<", $fn)) {
+        syscall &SYS_fadvise64, fileno(DECACHE), 0, -s DECACHE, 4;
+        close(DECACHE);
+    }
+}
+
+# makefile($filename, $size)
+#    Create `$filename` as `$size` bytes of dictionary words, unless it
+#    already has exactly that size.
+sub makefile ($$) {
+    my($filename, $size) = @_;
+    if (!-r $filename || !defined(-s $filename) || -s $filename != $size) {
+        while (!defined(-s $filename) || -s $filename < $size) {
+            system("cat /usr/share/dict/words >> $filename");
+        }
+        truncate($filename, $size);
+    }
+}
+
+1;
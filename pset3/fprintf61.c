@@ -0,0 +1,43 @@
+#include "io61.h"
+
+// Usage: ./fprintf61 [-b MAXLINESIZE] [-o OUTFILE] [FILE]
+//    Copies the input text FILE to OUTFILE one line at a time, numbering
+//    each line like `cat -n`. The output is written with `fprintf` on
+//    the stdio stream returned by `io61_fstream`. Lines longer than
+//    MAXLINESIZE are numbered in MAXLINESIZE pieces. Finally seeks to
+//    the end of OUTFILE (which fails harmlessly on a pipe) and appends
+//    the line count.
+//    Default MAXLINESIZE is 4096.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args = io61_parse_arguments(argc, argv, "b:o:");
+    size_t max_linesize = args.block_size ? args.block_size : 4096;
+
+    // Allocate buffer, open files
+    char* buf = (char*) malloc(max_linesize);
+
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+    FILE* out = io61_fstream(outf);
+
+    // Copy file data
+    size_t lineno;
+    for (lineno = 1; 1; ++lineno) {
+        ssize_t amount = io61_readline(inf, buf, max_linesize);
+        if (amount <= 0)
+            break;
+        fprintf(out, "%6zu\t%.*s", lineno, (int) amount, buf);
+    }
+
+    // The end of the file must include output that is still buffered
+    fseek(out, 0, SEEK_END);
+    fprintf(out, "%zu lines\n", lineno - 1);
+
+    io61_close(inf);
+    fclose(out);
+    io61_profile_end();
+    free(buf);
+}
@@ -18,8 +18,11 @@ int main(int argc, char* argv[]) {
 
     io61_profile_begin();
     io61_file** infs = (io61_file**) calloc(nfiles, sizeof(io61_file*));
-    for (int i = 0; i < nfiles; ++i)
+    for (int i = 0; i < nfiles; ++i) {
         infs[i] = io61_open_check(args.input_files[i], O_RDONLY);
+        // Overlap reads across the inputs (fails harmlessly on pipes)
+        io61_set_prefetch(infs[i]);
+    }
     io61_file* outf = io61_open_check(args.output_file,
                                       O_WRONLY | O_CREAT | O_TRUNC);
 
@@ -1,36 +1,352 @@
+#define _GNU_SOURCE     // SEEK_DATA, SEEK_HOLE, fallocate, splice, tee
 #include "io61.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <limits.h>
 #include <errno.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdatomic.h>
 
-#define BUF_SIZE 4096
+#define BUF_SIZE 4096   // Default cache buffer size
+#define PAGESIZE 4096
+#define HUGEPAGE_SIZE (2 << 20)
+#define NFREEBUFS 8     // Number of buffers kept for reuse after close
+#define MAXWRITEBEHIND 16   // Most buffers a write-behind file may queue
+#define NPREFETCHTHREADS 4  // Most prefetch reads outstanding at once
+#define PREFETCH_BUFSIZE 65536  // Smallest cache for prefetch-mode files
+#define COPY_CHUNK 65536    // Bytes `io61_copy` handles at a time
+#define SPLICE_CHUNK 65536  // Bytes spliced at a time; fits an empty pipe
+#define ZBLOCK 65536    // Uncompressed size of a compressed-mode block
+#define ZBOUND(n) ((n) + (n) / 255 + 16)    // Worst-case compressed size
+#define ZSTORED 0x80000000U // Frame flag: payload is not compressed
+#define RECORD_PREFETCH 512  // Bytes ahead of a record to prefetch
+#define CACHELINE 64
+#define BATCH_GAP 4096  // Largest hole read through when merging batch reads
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 // io61.c
 //    YOUR CODE HERE!
 
 
+// io61_writebehind
+//    State shared between an output file in write-behind mode and its
+//    writer thread. Filled buffers wait in `queue` until the thread has
+//    written them, then return to `spare`. Protected by `lock`; `cond`
+//    is broadcast on every change.
+
+typedef struct io61_writebehind {
+    int fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct io61_wbitem {
+        char* buf;
+        size_t len;
+    } queue[MAXWRITEBEHIND];
+    int qhead;      // Index of oldest queued buffer
+    int qlen;       // Number of queued buffers
+    char* spare[MAXWRITEBEHIND];
+    int nspare;     // Number of empty buffers in `spare`
+    int busy;       // 1 while the thread is writing a buffer
+    int error;      // 1 once a background write has failed
+    int stop;       // 1 when the thread should exit
+} io61_writebehind;
+
+
+// io61_shared
+//    State of an output file in thread-safe mode. `state` packs the
+//    buffer tail (low bits), the number of threads still copying into
+//    reserved space, and a "sealed" bit that stops new reservations
+//    while the buffer is written out. `lock` serializes writeouts.
+
+#define TS_TAIL(st)     ((st) & (((uint64_t) 1 << 40) - 1))
+#define TS_WRITER       ((uint64_t) 1 << 40)
+#define TS_NWRITERS(st) (((st) >> 40) & ((1 << 23) - 1))
+#define TS_SEALED       ((uint64_t) 1 << 63)
+
+typedef struct io61_shared {
+    _Atomic uint64_t state;
+    pthread_mutex_t lock;
+} io61_shared;
+
+
+// io61_zstate
+//    State of a file in compressed mode (see io61_set_compressed). The
+//    file is a sequence of frames, each an 8-byte header (uncompressed
+//    length, then stored length, possibly with ZSTORED set) followed by
+//    the payload. `index` records where each frame seen so far starts,
+//    so seeks can jump straight to the frame holding an offset.
+
+typedef struct io61_zframe {
+    off_t raw_off;  // Offset of the frame's data in the uncompressed stream
+    off_t file_off; // Offset of the frame header in the file
+} io61_zframe;
+
+typedef struct io61_zstate {
+    unsigned char* zbuf;    // Compressed frame payload
+    off_t next_file_off;    // File offset of the next frame to read
+    io61_zframe* index;     // Frames seen so far, in order
+    size_t nindex;
+    size_t capindex;
+    off_t index_end;        // Uncompressed offset just past `index`
+    int index_complete;     // 1 once `index` covers the whole file
+} io61_zstate;
+
+
+// io61_prefetch
+//    Readahead state of a file in prefetch mode (see io61_set_prefetch).
+//    `buf` holds, or is being filled with, the `bufsize` bytes at `off`.
+//    Files waiting for a prefetch thread are linked through `next` in
+//    the FIFO `prefetch_pool` queue.
+
+#define PF_IDLE     0   // `buf` is unused
+#define PF_QUEUED   1   // Waiting for a prefetch thread
+#define PF_BUSY     2   // A prefetch thread is reading into `buf`
+#define PF_READY    3   // `buf` holds `result` bytes at `off`
+
+typedef struct io61_prefetch {
+    int fd;
+    char* buf;
+    size_t bufsize;
+    size_t mapsize;
+    off_t off;
+    ssize_t result;
+    int state;
+    struct io61_prefetch* next;
+} io61_prefetch;
+
+static struct io61_prefetch_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work;        // Signaled when `head` becomes nonempty
+    pthread_cond_t done;        // Signaled when a read finishes
+    io61_prefetch* head;
+    io61_prefetch* tail;
+    int nfiles;                 // Files in prefetch mode
+    int stop;
+    pthread_t threads[NPREFETCHTHREADS];
+    int nthreads;               // Entries of `threads` that started
+} prefetch_pool = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    PTHREAD_COND_INITIALIZER, NULL, NULL, 0, 0, {0}, 0
+};
+
+
 // io61_file
 //    Data structure for io61 file wrappers. Add your own stuff.
 
 struct io61_file {
     int fd;
-    char buff[BUF_SIZE];
+    int mode;       // O_RDONLY, or O_WRONLY/O_RDWR for output files
+    char* buff;     // Cache buffer
+    size_t bufsize; // Usable size of `buff`
+    size_t mapsize; // Size of the mapping holding `buff`
+    int bufflags;   // IO61_BUF_ flags `buff` was allocated with
+    io61_writebehind* wb;   // Write-behind state, or NULL
+    io61_shared* ts;        // Thread-safe mode state, or NULL
+    io61_zstate* z;         // Compressed mode state, or NULL
+    io61_prefetch* pf;      // Prefetch mode state, or NULL
+    int nonblocking;        // 1 if the descriptor is O_NONBLOCK
+    int fdflags;            // F_GETFL flags from before nonblocking mode
+    int checksumming;       // 1 if `crc` is being maintained
+    uint32_t crc;           // Running CRC32C (inverted) of data passed
+    char* outmap;   // Shared mapping of an output file, or NULL
+    off_t outsize;  // Size of `outmap`
     off_t tag;      // Offset in file of first byte in cache
     off_t end_tag;  // Offset in file of first INVALID byte in cache
     off_t pos_tag;  // Offset in file of next byte to read in cache.
+    off_t flushed;  // Bytes at the start of the cache already written
 };
 
 
+// io61_buffer_alloc(size, flags, mapsize)
+//    Return a cache buffer of at least `size` bytes and set `*mapsize` to
+//    the size of its mapping. Buffers released by `io61_buffer_free` are
+//    reused when their size matches, so files opened one after another
+//    share memory that is already faulted in. Otherwise the buffer is a
+//    fresh anonymous mapping. With IO61_BUF_HUGE it is backed by
+//    MAP_HUGETLB pages, or failing that by a huge-page-aligned region
+//    marked MADV_HUGEPAGE; with IO61_BUF_PREFAULT every page is faulted in
+//    now rather than on first touch. Returns NULL if memory is exhausted.
+//    The freelist is shared by every thread, so `freebufs_lock` guards it.
+
+static struct io61_freebuf {
+    char* base;
+    size_t size;
+} freebufs[NFREEBUFS];
+static int nfreebufs;
+static pthread_mutex_t freebufs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char* io61_buffer_alloc(size_t size, int flags, size_t* mapsize) {
+    size_t align = flags & IO61_BUF_HUGE ? HUGEPAGE_SIZE : PAGESIZE;
+    size_t msize = (size + align - 1) & ~(align - 1);
+    *mapsize = msize;
+    pthread_mutex_lock(&freebufs_lock);
+    for (int i = 0; i != nfreebufs; ++i)
+        if (freebufs[i].size == msize) {
+            char* base = freebufs[i].base;
+            freebufs[i] = freebufs[nfreebufs - 1];
+            --nfreebufs;
+            pthread_mutex_unlock(&freebufs_lock);
+            return base;
+        }
+    pthread_mutex_unlock(&freebufs_lock);
+
+    int mflags = MAP_PRIVATE | MAP_ANONYMOUS;
+    char* base = MAP_FAILED;
+    if (flags & IO61_BUF_HUGE)
+        base = (char*) mmap(NULL, msize, PROT_READ | PROT_WRITE,
+                            mflags | MAP_HUGETLB
+                            | (flags & IO61_BUF_PREFAULT ? MAP_POPULATE : 0),
+                            -1, 0);
+    if (base != MAP_FAILED)
+        return base;
+
+    // No hugetlbfs pages: ask for transparent huge pages instead, which
+    // only back regions aligned to HUGEPAGE_SIZE.
+    size_t extra = flags & IO61_BUF_HUGE ? HUGEPAGE_SIZE : 0;
+    base = (char*) mmap(NULL, msize + extra, PROT_READ | PROT_WRITE,
+                        mflags, -1, 0);
+    if (base == MAP_FAILED)
+        return NULL;
+    if (extra) {
+        size_t head = -(size_t) base & (HUGEPAGE_SIZE - 1);
+        if (head)
+            munmap(base, head);
+        if (extra - head)
+            munmap(base + head + msize, extra - head);
+        base += head;
+        madvise(base, msize, MADV_HUGEPAGE);
+    }
+    if (flags & IO61_BUF_PREFAULT)
+        for (size_t off = 0; off < msize; off += PAGESIZE)
+            base[off] = 0;
+    return base;
+}
+
+
+// io61_buffer_free(base, mapsize)
+//    Release a buffer returned by `io61_buffer_alloc`, keeping it on the
+//    freelist for reuse if there is room.
+
+static void io61_buffer_free(char* base, size_t mapsize) {
+    pthread_mutex_lock(&freebufs_lock);
+    if (nfreebufs != NFREEBUFS) {
+        freebufs[nfreebufs].base = base;
+        freebufs[nfreebufs].size = mapsize;
+        ++nfreebufs;
+        base = NULL;
+    }
+    pthread_mutex_unlock(&freebufs_lock);
+    if (base)
+        munmap(base, mapsize);
+}
+
+
+// crc32c_update(crc, p, n)
+//    Extend the running CRC32C (Castagnoli) value `crc` over `p[0..n)`.
+//    Points at `crc32c_update_sse42`, which uses the SSE4.2 crc32
+//    instruction eight bytes at a time, when the CPU supports it, and
+//    at the table-driven `crc32c_update_table` otherwise. Set up by
+//    `crc32c_init`. Setting the environment variable IO61_CRC32C_TABLE
+//    forces the table, so that both versions can be tested on one CPU.
+
+static uint32_t crc32c_table[256];
+
+static uint32_t crc32c_update_table(uint32_t crc, const unsigned char* p,
+                                    size_t n) {
+    for (; n != 0; --n, ++p)
+        crc = crc32c_table[(crc ^ *p) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_update_sse42(uint32_t crc, const unsigned char* p,
+                                    size_t n) {
+    uint64_t c = crc;
+    for (; n != 0 && ((uintptr_t) p & 7); --n, ++p)
+        c = __builtin_ia32_crc32qi(c, *p);
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        c = __builtin_ia32_crc32di(c, w);
+    }
+    for (; n != 0; --n, ++p)
+        c = __builtin_ia32_crc32qi(c, *p);
+    return c;
+}
+#endif
+
+static uint32_t (*crc32c_update)(uint32_t, const unsigned char*, size_t);
+
+static void crc32c_init(void) {
+    for (uint32_t i = 0; i != 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k != 8; ++k)
+            c = c & 1 ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+        crc32c_table[i] = c;
+    }
+    crc32c_update = crc32c_update_table;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2") && !getenv("IO61_CRC32C_TABLE"))
+        crc32c_update = crc32c_update_sse42;
+#endif
+}
+
+
+// io61_write_fully(fd, buf, sz)
+//    Write all of `buf[0..sz)` to `fd`, retrying short writes. Returns
+//    `sz` on success and -1 on error.
+
+static ssize_t io61_write_fully(int fd, const char* buf, size_t sz) {
+    size_t pos = 0;
+    while (pos != sz) {
+        ssize_t n = write(fd, buf + pos, sz - pos);
+        if (n > 0)
+            pos += n;
+        else if (n < 0 && errno == EINTR)
+            continue;
+        else
+            return -1;
+    }
+    return pos;
+}
+
+
 // io61_fdopen(fd, mode)
 //    Return a new io61_file for file descriptor `fd`. `mode` is
 //    either O_RDONLY for a read-only file or O_WRONLY for a
 //    write-only file. You need not support read/write files.
+//    Returns NULL if memory is exhausted.
 
 io61_file* io61_fdopen(int fd, int mode) {
     assert(fd >= 0);
     io61_file* f = (io61_file*) malloc(sizeof(io61_file));
+    if (!f)
+        return NULL;
     f->fd = fd;
-    (void) mode;
+    f->mode = mode;
+    f->buff = io61_buffer_alloc(BUF_SIZE, 0, &f->mapsize);
+    if (!f->buff) {
+        free(f);
+        return NULL;
+    }
+    f->bufsize = BUF_SIZE;
+    f->bufflags = 0;
+    f->wb = NULL;
+    f->ts = NULL;
+    f->z = NULL;
+    f->pf = NULL;
+    f->nonblocking = 0;
+    f->checksumming = 0;
+    f->outmap = NULL;
+    f->tag = f->end_tag = f->pos_tag = 0;
+    f->flushed = 0;
     return f;
 }
 
@@ -38,9 +354,35 @@ io61_file* io61_fdopen(int fd, int mode) {
 // io61_close(f)
 //    Close the io61_file `f` and release all its resources.
 
+static void io61_writebehind_stop(io61_file* f);
+static void io61_prefetch_stop(io61_file* f);
+
 int io61_close(io61_file* f) {
-    io61_flush(f);
+    if (f->nonblocking)
+        // The flags belong to the open file description, which others
+        // may share; restoring them also lets us finish writing
+        // buffered data rather than dropping it
+        fcntl(f->fd, F_SETFL, f->fdflags);
+    int fr = io61_flush(f);
+    if (f->wb)
+        io61_writebehind_stop(f);
+    if (f->outmap)
+        munmap(f->outmap, f->outsize);
+    if (f->ts) {
+        pthread_mutex_destroy(&f->ts->lock);
+        free(f->ts);
+    }
+    if (f->z) {
+        free(f->z->zbuf);
+        free(f->z->index);
+        free(f->z);
+    }
+    if (f->pf)
+        io61_prefetch_stop(f);
     int r = close(f->fd);
+    if (fr < 0)
+        r = -1;
+    io61_buffer_free(f->buff, f->mapsize);
     free(f);
     return r;
 }
@@ -59,6 +401,220 @@ int io61_readc(io61_file* f) {
 }
 
 
+// io61_fill(f)
+//    Refill the buffer of read-only file `f` with the next chunk of the
+//    file, starting at `f->end_tag`. Returns the result of `read()`:
+//    positive if new data was cached, 0 at end of file, -1 on error.
+
+static ssize_t io61_zfill(io61_file* f);
+static ssize_t io61_prefetch_fill(io61_file* f);
+
+static ssize_t io61_fill(io61_file* f) {
+    if (f->z)
+        return io61_zfill(f);
+    if (f->pf)
+        return io61_prefetch_fill(f);
+    f->tag = f->end_tag;
+    ssize_t read_res = read(f->fd, f->buff, f->bufsize);
+    if (read_res > 0)
+        f->end_tag += read_res;
+    return read_res;
+}
+
+
+// io61_set_prefetch(f)
+//    Put read-only file `f` in prefetch mode. Whenever `f` refills its
+//    cache, it queues a read of the following chunk for a shared pool of
+//    NPREFETCHTHREADS threads, so a program that reads many files in
+//    turn has up to NPREFETCHTHREADS reads in flight across them instead
+//    of blocking on each file's cold data in sequence. The queue is
+//    first-in first-out, so reads are issued in the order files last
+//    refilled, which for round-robin readers is the order they will next
+//    run dry. Each file in prefetch mode holds one extra cache buffer,
+//    and its cache is grown to at least PREFETCH_BUFSIZE bytes so each
+//    handoff to a thread moves enough data to pay for itself.
+//    `f` must be a seekable file; prefetch mode excludes compressed and
+//    nonblocking modes and later `io61_setvbuf` calls. Returns 0 on
+//    success and -1 on failure.
+
+static void* io61_prefetch_thread(void* arg);
+static void io61_prefetch_queue(io61_prefetch* pf, off_t off);
+
+int io61_set_prefetch(io61_file* f) {
+    if (f->mode != O_RDONLY || f->pf || f->z || f->nonblocking
+        || lseek(f->fd, 0, SEEK_CUR) < 0)
+        return -1;
+    if (f->bufsize < PREFETCH_BUFSIZE
+        && io61_setvbuf(f, PREFETCH_BUFSIZE, f->bufflags) < 0)
+        return -1;
+    io61_prefetch* pf = (io61_prefetch*) malloc(sizeof(io61_prefetch));
+    if (!pf)
+        return -1;
+    pf->fd = f->fd;
+    pf->bufsize = f->bufsize;
+    pf->buf = io61_buffer_alloc(f->bufsize, f->bufflags, &pf->mapsize);
+    if (!pf->buf) {
+        free(pf);
+        return -1;
+    }
+    pf->state = PF_IDLE;
+    pf->next = NULL;
+
+    pthread_mutex_lock(&prefetch_pool.lock);
+    if (prefetch_pool.nfiles == 0) {
+        prefetch_pool.stop = 0;
+        prefetch_pool.nthreads = 0;
+        for (int i = 0; i != NPREFETCHTHREADS; ++i) {
+            if (pthread_create(&prefetch_pool.threads[i], NULL,
+                               io61_prefetch_thread, NULL) != 0)
+                break;
+            ++prefetch_pool.nthreads;
+        }
+        if (prefetch_pool.nthreads == 0) {
+            pthread_mutex_unlock(&prefetch_pool.lock);
+            io61_buffer_free(pf->buf, pf->mapsize);
+            free(pf);
+            return -1;
+        }
+    }
+    ++prefetch_pool.nfiles;
+    f->pf = pf;
+    // Start on the chunk after the cache (which is usually empty)
+    if (f->pos_tag == f->end_tag)
+        io61_prefetch_queue(pf, f->end_tag);
+    pthread_mutex_unlock(&prefetch_pool.lock);
+    return 0;
+}
+
+
+// io61_prefetch_queue(pf, off)
+//    Queue a prefetch of the chunk at `off`. Caller holds the pool lock
+//    and `pf` is idle or ready.
+
+static void io61_prefetch_queue(io61_prefetch* pf, off_t off) {
+    pf->off = off;
+    pf->state = PF_QUEUED;
+    pf->next = NULL;
+    if (prefetch_pool.tail)
+        prefetch_pool.tail->next = pf;
+    else
+        prefetch_pool.head = pf;
+    prefetch_pool.tail = pf;
+    pthread_cond_signal(&prefetch_pool.work);
+}
+
+
+// io61_prefetch_cancel(pf)
+//    Make `pf` idle, removing it from the queue or waiting for its
+//    in-flight read to finish. Caller holds the pool lock.
+
+static void io61_prefetch_cancel(io61_prefetch* pf) {
+    if (pf->state == PF_QUEUED) {
+        io61_prefetch** pp = &prefetch_pool.head;
+        io61_prefetch* prev = NULL;
+        while (*pp != pf) {
+            prev = *pp;
+            pp = &(*pp)->next;
+        }
+        *pp = pf->next;
+        if (prefetch_pool.tail == pf)
+            prefetch_pool.tail = prev;
+    }
+    while (pf->state == PF_BUSY)
+        pthread_cond_wait(&prefetch_pool.done, &prefetch_pool.lock);
+    pf->state = PF_IDLE;
+}
+
+
+// io61_prefetch_thread(arg)
+//    Body of a prefetch thread: serve queued reads in order.
+
+static void* io61_prefetch_thread(void* arg) {
+    (void) arg;
+    pthread_mutex_lock(&prefetch_pool.lock);
+    while (1) {
+        while (!prefetch_pool.head && !prefetch_pool.stop)
+            pthread_cond_wait(&prefetch_pool.work, &prefetch_pool.lock);
+        if (!prefetch_pool.head)
+            break;
+        io61_prefetch* pf = prefetch_pool.head;
+        prefetch_pool.head = pf->next;
+        if (!prefetch_pool.head)
+            prefetch_pool.tail = NULL;
+        pf->state = PF_BUSY;
+        pthread_mutex_unlock(&prefetch_pool.lock);
+
+        ssize_t n = pread(pf->fd, pf->buf, pf->bufsize, pf->off);
+
+        pthread_mutex_lock(&prefetch_pool.lock);
+        pf->result = n;
+        pf->state = PF_READY;
+        pthread_cond_broadcast(&prefetch_pool.done);
+    }
+    pthread_mutex_unlock(&prefetch_pool.lock);
+    return NULL;
+}
+
+
+// io61_prefetch_fill(f)
+//    Refill the cache of prefetch-mode file `f` starting at `f->end_tag`.
+//    Takes the prefetched chunk if it is for that offset, waiting for it
+//    if it is in flight, and otherwise reads directly. Then queues the
+//    next chunk. Same return values as `io61_fill`.
+
+static ssize_t io61_prefetch_fill(io61_file* f) {
+    io61_prefetch* pf = f->pf;
+    f->tag = f->end_tag;
+    ssize_t n;
+    pthread_mutex_lock(&prefetch_pool.lock);
+    if (pf->state == PF_QUEUED && pf->off == f->end_tag)
+        // Still waiting for a thread; reading it ourselves is no slower
+        io61_prefetch_cancel(pf);
+    while (pf->state == PF_BUSY && pf->off == f->end_tag)
+        pthread_cond_wait(&prefetch_pool.done, &prefetch_pool.lock);
+    if (pf->state == PF_READY && pf->off == f->end_tag) {
+        char* buf = f->buff;
+        f->buff = pf->buf;
+        pf->buf = buf;
+        n = pf->result;
+        pf->state = PF_IDLE;
+    } else {
+        io61_prefetch_cancel(pf);
+        pthread_mutex_unlock(&prefetch_pool.lock);
+        n = pread(f->fd, f->buff, f->bufsize, f->end_tag);
+        pthread_mutex_lock(&prefetch_pool.lock);
+    }
+    if (n > 0) {
+        f->end_tag += n;
+        io61_prefetch_queue(pf, f->end_tag);
+    }
+    pthread_mutex_unlock(&prefetch_pool.lock);
+    return n;
+}
+
+
+// io61_prefetch_stop(f)
+//    Take `f` out of prefetch mode and free its readahead buffer. The
+//    pool threads exit when the last file leaves prefetch mode.
+
+static void io61_prefetch_stop(io61_file* f) {
+    pthread_mutex_lock(&prefetch_pool.lock);
+    io61_prefetch_cancel(f->pf);
+    int last = --prefetch_pool.nfiles == 0;
+    if (last) {
+        prefetch_pool.stop = 1;
+        pthread_cond_broadcast(&prefetch_pool.work);
+    }
+    pthread_mutex_unlock(&prefetch_pool.lock);
+    if (last)
+        for (int i = 0; i != prefetch_pool.nthreads; ++i)
+            pthread_join(prefetch_pool.threads[i], NULL);
+    io61_buffer_free(f->pf->buf, f->pf->mapsize);
+    free(f->pf);
+    f->pf = NULL;
+}
+
+
 // io61_read(f, buf, sz)
 //    Read up to `sz` characters from `f` into `buf`. Returns the number of
 //    characters read on success; normally this is `sz`. Returns a short
@@ -75,14 +631,15 @@ ssize_t io61_read(io61_file* f, char* buf, size_t sz)
             if (to_read > f->end_tag - f->pos_tag) //If buff doesn't have all
                 to_read = f->end_tag - f->pos_tag; //Only read til end of buf
             memcpy(&buf[bytes_read], &f->buff[f->pos_tag - f->tag], to_read);
+            if (f->checksumming)
+                f->crc = crc32c_update(f->crc,
+                                       (unsigned char*) &buf[bytes_read],
+                                       to_read);
             f->pos_tag += to_read;
             bytes_read += to_read;
         } else { // Buffer needs to be refilled
-            f->tag = f->end_tag;
-            ssize_t read_res = read(f->fd, f->buff, BUF_SIZE);
-            if (read_res > 0)
-                f->end_tag += read_res;
-            else // EOF or read() failed
+            ssize_t read_res = io61_fill(f);
+            if (read_res <= 0) // EOF or read() failed
                 // Return bytes read or result of read() if none has been read
                 return bytes_read ? bytes_read : read_res;
         }
@@ -91,6 +648,129 @@ ssize_t io61_read(io61_file* f, char* buf, size_t sz)
 }
 
 
+// io61_read_until(f, delim, buf, sz)
+//    Read characters from `f` into `buf` up to and including the first
+//    occurrence of the character `delim`, reading at most `sz` characters.
+//    Returns the number of characters read. The result ends with `delim`
+//    unless the record was longer than `sz` or the file ended first; it is
+//    0 at end of file. Returns -1 if an error occurred before any
+//    characters were read.
+//    Each cached chunk is scanned with `memchr`, which the C library
+//    implements with SSE2/AVX2, so a record costs one scan and one copy
+//    per buffer it touches instead of a function call per character.
+//    Records that span a refill are assembled piece by piece.
+
+ssize_t io61_read_until(io61_file* f, int delim, char* buf, size_t sz) {
+    size_t bytes_read = 0;
+    while (bytes_read != sz) {
+        if (f->pos_tag < f->end_tag) {
+            size_t n = f->end_tag - f->pos_tag;
+            if (n > sz - bytes_read)
+                n = sz - bytes_read;
+            const char* start = &f->buff[f->pos_tag - f->tag];
+            const char* found = (const char*) memchr(start, delim, n);
+            if (found)
+                n = found - start + 1;
+            memcpy(&buf[bytes_read], start, n);
+            if (f->checksumming)
+                f->crc = crc32c_update(f->crc, (unsigned char*) start, n);
+            f->pos_tag += n;
+            bytes_read += n;
+            if (found)
+                break;
+        } else {
+            ssize_t read_res = io61_fill(f);
+            if (read_res <= 0)
+                return bytes_read ? (ssize_t) bytes_read : read_res;
+        }
+    }
+    return bytes_read;
+}
+
+
+// io61_readline(f, buf, sz)
+//    Read one newline-terminated line from `f` into `buf`, reading at most
+//    `sz` characters. Same return values as `io61_read_until`.
+
+ssize_t io61_readline(io61_file* f, char* buf, size_t sz) {
+    return io61_read_until(f, '\n', buf, sz);
+}
+
+
+// io61_records_open(f, record_size)
+//    Return an iterator over the `record_size`-byte records of read-only
+//    file `f`, starting at its current position. Step through them with
+//    `io61_records_next` and free the iterator with `io61_records_close`;
+//    `f` stays open. Returns NULL if `record_size` is 0, if `f` is not a
+//    blocking read-only file, or if memory is exhausted.
+
+struct io61_records {
+    io61_file* f;
+    size_t size;    // Bytes per record
+    char* stage;    // Assembles records that straddle a refill
+};
+
+io61_records* io61_records_open(io61_file* f, size_t record_size) {
+    if (record_size == 0 || f->mode != O_RDONLY || f->nonblocking)
+        return NULL;
+    io61_records* r = (io61_records*) malloc(sizeof(io61_records));
+    if (!r)
+        return NULL;
+    r->f = f;
+    r->size = record_size;
+    r->stage = (char*) malloc(record_size);
+    if (!r->stage) {
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+
+// io61_records_next(r, recp)
+//    Set `*recp` to the next record of `r` and return its length: the
+//    record size, or a short count for a final partial record. Returns 0
+//    at end of file and -1 on error. Records normally point straight
+//    into the cache; only records that straddle a refill, or that are
+//    larger than the cache, are copied into a staging buffer. Either way
+//    `*recp` is valid until the next call. The cache lines
+//    RECORD_PREFETCH bytes past each record are prefetched, so a scan
+//    seldom waits on memory.
+
+ssize_t io61_records_next(io61_records* r, const char** recp) {
+    io61_file* f = r->f;
+    if (f->pos_tag == f->end_tag && r->size <= f->bufsize) {
+        ssize_t read_res = io61_fill(f);
+        if (read_res <= 0)
+            return read_res;
+    }
+    if (f->end_tag - f->pos_tag < (off_t) r->size) {
+        *recp = r->stage;
+        return io61_read(f, r->stage, r->size);
+    }
+
+    size_t off = f->pos_tag - f->tag, avail = f->end_tag - f->tag;
+    for (size_t a = off + RECORD_PREFETCH;
+         a < off + RECORD_PREFETCH + r->size && a < avail;
+         a += CACHELINE)
+        __builtin_prefetch(&f->buff[a]);
+    *recp = &f->buff[off];
+    if (f->checksumming)
+        f->crc = crc32c_update(f->crc, (unsigned char*) *recp, r->size);
+    f->pos_tag += r->size;
+    return r->size;
+}
+
+
+// io61_records_close(r)
+//    Free the record iterator `r`.
+
+void io61_records_close(io61_records* r) {
+    free(r->stage);
+    free(r);
+}
+
+
 // io61_writec(f)
 //    Write a single character `ch` to `f`. Returns 0 on success or
 //    -1 on error.
@@ -128,22 +808,43 @@ int io61_writec(io61_file* f, int ch) {
 //    return res;
 //}
 
+static int io61_writeout(io61_file* f);
+static ssize_t io61_write_shared(io61_file* f, const char* buf, size_t sz);
+
 ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
+   if (f->ts)
+       return io61_write_shared(f, buf, sz);
+   if (f->outmap) {
+       // Mapped output: writes are stores, truncated at the mapping's end
+       if (f->pos_tag >= f->outsize)
+           return sz ? -1 : 0;
+       if ((off_t) sz > f->outsize - f->pos_tag)
+           sz = f->outsize - f->pos_tag;
+       memcpy(&f->outmap[f->pos_tag], buf, sz);
+       if (f->checksumming)
+           f->crc = crc32c_update(f->crc, (unsigned char*) buf, sz);
+       f->pos_tag += sz;
+       return sz;
+   }
    size_t bytes_read = 0; // Update as we read data and is the ret value
    while (bytes_read != sz) { // if we haven't already read sz amount of data
-       if (f->pos_tag - f->tag < BUF_SIZE) {
+       if (f->pos_tag - f->tag < (off_t) f->bufsize) {
            ssize_t n = sz - bytes_read; //set n as the number of bytes left to read
-           if (BUF_SIZE - (f->pos_tag - f->tag) < n) //if n is greater than size of buffer left to write
-               n = BUF_SIZE - (f->pos_tag - f->tag); //set n as the size of buffer left to write
+           if ((ssize_t) (f->bufsize - (f->pos_tag - f->tag)) < n) //if n is greater than size of buffer left to write
+               n = f->bufsize - (f->pos_tag - f->tag); //set n as the size of buffer left to write
            memcpy(&f->buff[f->pos_tag - f->tag], &buf[bytes_read], n);
+           if (f->checksumming)
+               f->crc = crc32c_update(f->crc, (unsigned char*) &buf[bytes_read],
+                                      n);
            f->pos_tag += n;
            if (f->pos_tag > f->end_tag)
                      f->end_tag = f->pos_tag;
            bytes_read += n;
        }
        assert(f->pos_tag <= f->end_tag);
-       if (f->pos_tag - f->tag == BUF_SIZE) //if we wrote everything in the buffer
-           io61_flush(f); //flush f
+       if (f->pos_tag - f->tag == (off_t) f->bufsize) //if we wrote everything in the buffer
+           if (io61_writeout(f) < 0) //write it out
+               return bytes_read ? (ssize_t) bytes_read : -1;
    }
 
    return bytes_read;
@@ -154,26 +855,822 @@ ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
 //    If `f` was opened read-only, io61_flush(f) may either drop all
 //    data buffered for reading, or do nothing.
 
+static int io61_writebehind_wait(io61_writebehind* wb);
+
+static ssize_t io61_flush_shared(io61_file* f, const char* buf, size_t sz);
+
 int io61_flush(io61_file* f) {
-    if (f->end_tag != f->tag) {
-        ssize_t n = write(f->fd, f->buff, f->end_tag - f->tag);
-        assert(n == f->end_tag - f->tag);
+    if (f->mode == O_RDONLY || f->outmap)
+        return 0;
+    if (f->ts)
+        return io61_flush_shared(f, NULL, 0);
+    int r = io61_writeout(f);
+    if (f->wb && io61_writebehind_wait(f->wb) < 0)
+        r = -1;
+    return r;
+}
+
+
+// io61_writeout(f)
+//    Start writing the buffered data of output file `f` and empty the
+//    buffer. Normally the data is written before returning; in
+//    write-behind mode the buffer is queued for the writer thread and
+//    replaced with a spare one, waiting only if every spare is in use.
+//    Returns 0 on success and -1 if a write has failed.
+
+static int io61_zwriteout(io61_file* f);
+
+static int io61_writeout(io61_file* f) {
+    if (f->end_tag != f->tag && f->z) {
+        if (io61_zwriteout(f) < 0)
+            return -1;
+    } else if (f->end_tag != f->tag && f->wb) {
+        io61_writebehind* wb = f->wb;
+        pthread_mutex_lock(&wb->lock);
+        while (wb->nspare == 0)
+            pthread_cond_wait(&wb->cond, &wb->lock);
+        int i = (wb->qhead + wb->qlen) % MAXWRITEBEHIND;
+        wb->queue[i].buf = f->buff;
+        wb->queue[i].len = f->end_tag - f->tag;
+        ++wb->qlen;
+        --wb->nspare;
+        f->buff = wb->spare[wb->nspare];
+        int error = wb->error;
+        pthread_cond_broadcast(&wb->cond);
+        pthread_mutex_unlock(&wb->lock);
+        if (error)
+            return -1;
+    } else if (f->end_tag != f->tag) {
+        // Pick up after any partial write that a nonblocking
+        // descriptor cut short
+        while (f->tag + f->flushed != f->end_tag) {
+            ssize_t n = write(f->fd, &f->buff[f->flushed],
+                              f->end_tag - f->tag - f->flushed);
+            if (n > 0)
+                f->flushed += n;
+            else if (n == 0 || errno != EINTR)
+                return -1;
+        }
+        f->flushed = 0;
     }
     f->pos_tag = f->tag = f->end_tag;
     return 0;
 }
 
 
+// io61_set_nonblocking(f)
+//    Put `f` in nonblocking mode by setting O_NONBLOCK on its descriptor.
+//    `io61_read` and `io61_write` then return a short count as soon as
+//    the descriptor would block, or -1 with `errno` set to EAGAIN if they
+//    made no progress at all; `io61_flush` returns -1 with EAGAIN while
+//    buffered data remains, and remembers how much was written so the
+//    next call continues from there. An event loop should wait on
+//    `io61_pollfd(f)` for input whenever a read fails with EAGAIN, and
+//    for output while `io61_wants_write(f)` is true, calling `io61_flush`
+//    when it becomes writable. `io61_close` restores the descriptor's
+//    original flags and blocks to drain output.
+//    Nonblocking mode excludes write-behind, thread-safe, compressed,
+//    prefetch and mapped output modes. Returns 0 on success and -1 on failure.
+
+int io61_set_nonblocking(io61_file* f) {
+    if (f->wb || f->ts || f->z || f->pf || f->outmap)
+        return -1;
+    int flags = fcntl(f->fd, F_GETFL);
+    if (flags < 0 || fcntl(f->fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return -1;
+    if (!f->nonblocking)
+        f->fdflags = flags;
+    f->nonblocking = 1;
+    return 0;
+}
+
+
+// io61_pollfd(f)
+//    Return the file descriptor an event loop should poll for `f`.
+
+int io61_pollfd(io61_file* f) {
+    return f->fd;
+}
+
+
+// io61_wants_write(f)
+//    Return 1 if output file `f` holds buffered data that has not been
+//    written yet, meaning the caller should poll for POLLOUT/EPOLLOUT and
+//    call `io61_flush` when the descriptor is writable.
+
+int io61_wants_write(io61_file* f) {
+    return f->mode != O_RDONLY && !f->outmap && f->end_tag != f->tag;
+}
+
+
+// io61_set_writebehind(f, nbuffers)
+//    Put output file `f` in write-behind mode: full buffers are written
+//    by a background thread while the caller fills a fresh buffer, so
+//    producers are not stalled by device write latency. At most
+//    `nbuffers` buffers are outstanding at once; a writer that gets
+//    further ahead waits for the thread. `io61_flush` and `io61_close`
+//    wait until all queued data is written. Once write-behind is on,
+//    `io61_setvbuf` and `io61_map_output` fail. Returns 0 on success and
+//    -1 on failure.
+
+static void* io61_writebehind_thread(void* arg);
+
+int io61_set_writebehind(io61_file* f, int nbuffers) {
+    if (f->mode == O_RDONLY || f->wb || f->ts || f->outmap || f->z
+        || f->nonblocking
+        || nbuffers < 1 || nbuffers > MAXWRITEBEHIND)
+        return -1;
+    io61_writebehind* wb = (io61_writebehind*) malloc(sizeof(*wb));
+    if (!wb)
+        return -1;
+    wb->fd = f->fd;
+    wb->qhead = wb->qlen = wb->busy = wb->error = wb->stop = 0;
+    for (wb->nspare = 0; wb->nspare != nbuffers; ++wb->nspare) {
+        // Spares trade places with `f->buff`, so each must have the
+        // same mapping size, `f->mapsize`
+        size_t mapsize;
+        char* buf = io61_buffer_alloc(f->bufsize, f->bufflags, &mapsize);
+        if (buf && mapsize != f->mapsize)
+            io61_buffer_free(buf, mapsize);
+        if (!buf || mapsize != f->mapsize)
+            goto fail;
+        wb->spare[wb->nspare] = buf;
+    }
+    pthread_mutex_init(&wb->lock, NULL);
+    pthread_cond_init(&wb->cond, NULL);
+    if (pthread_create(&wb->thread, NULL, io61_writebehind_thread, wb) != 0) {
+        pthread_mutex_destroy(&wb->lock);
+        pthread_cond_destroy(&wb->cond);
+        goto fail;
+    }
+    f->wb = wb;
+    return 0;
+
+ fail:
+    while (wb->nspare != 0) {
+        --wb->nspare;
+        io61_buffer_free(wb->spare[wb->nspare], f->mapsize);
+    }
+    free(wb);
+    return -1;
+}
+
+static void* io61_writebehind_thread(void* arg) {
+    io61_writebehind* wb = (io61_writebehind*) arg;
+    pthread_mutex_lock(&wb->lock);
+    while (1) {
+        while (wb->qlen == 0 && !wb->stop)
+            pthread_cond_wait(&wb->cond, &wb->lock);
+        if (wb->qlen == 0)
+            break;
+        struct io61_wbitem item = wb->queue[wb->qhead];
+        wb->busy = 1;
+        pthread_mutex_unlock(&wb->lock);
+
+        int error = io61_write_fully(wb->fd, item.buf, item.len) < 0;
+
+        pthread_mutex_lock(&wb->lock);
+        wb->qhead = (wb->qhead + 1) % MAXWRITEBEHIND;
+        --wb->qlen;
+        wb->busy = 0;
+        wb->spare[wb->nspare] = item.buf;
+        ++wb->nspare;
+        wb->error |= error;
+        pthread_cond_broadcast(&wb->cond);
+    }
+    pthread_mutex_unlock(&wb->lock);
+    return NULL;
+}
+
+
+// io61_writebehind_wait(wb)
+//    Wait until the writer thread has written every queued buffer.
+//    Returns 0 if all background writes succeeded and -1 otherwise.
+
+static int io61_writebehind_wait(io61_writebehind* wb) {
+    pthread_mutex_lock(&wb->lock);
+    while (wb->qlen != 0)
+        pthread_cond_wait(&wb->cond, &wb->lock);
+    int error = wb->error;
+    pthread_mutex_unlock(&wb->lock);
+    return error ? -1 : 0;
+}
+
+
+// io61_writebehind_stop(f)
+//    Shut down the writer thread of `f` and free its spare buffers.
+//    Queued data must already have been flushed.
+
+static void io61_writebehind_stop(io61_file* f) {
+    io61_writebehind* wb = f->wb;
+    pthread_mutex_lock(&wb->lock);
+    wb->stop = 1;
+    pthread_cond_broadcast(&wb->cond);
+    pthread_mutex_unlock(&wb->lock);
+    pthread_join(wb->thread, NULL);
+    pthread_mutex_destroy(&wb->lock);
+    pthread_cond_destroy(&wb->cond);
+    while (wb->nspare != 0) {
+        --wb->nspare;
+        io61_buffer_free(wb->spare[wb->nspare], f->mapsize);
+    }
+    free(wb);
+    f->wb = NULL;
+}
+
+
+// io61_set_threadsafe(f)
+//    Allow several threads to write to output file `f` at once. Each
+//    `io61_write` lands contiguously in the file. A writer reserves
+//    space at the buffer tail with one compare-and-swap and copies its
+//    data without taking a lock, so an uncontended writer pays no more
+//    than an atomic operation. Only when the buffer is full (or on
+//    `io61_flush`) does a thread take `lock`, seal the buffer, wait for
+//    copies in progress to finish, and write it out. Thread-safe files
+//    cannot seek, and do not combine with write-behind or mapped output.
+//    Returns 0 on success and -1 on failure.
+
+int io61_set_threadsafe(io61_file* f) {
+    if (f->mode == O_RDONLY || f->ts || f->wb || f->outmap || f->z
+        || f->nonblocking
+        || f->checksumming)
+        return -1;
+    if (io61_flush(f) < 0)
+        return -1;
+    io61_shared* ts = (io61_shared*) malloc(sizeof(io61_shared));
+    if (!ts)
+        return -1;
+    atomic_init(&ts->state, 0);
+    pthread_mutex_init(&ts->lock, NULL);
+    f->ts = ts;
+    return 0;
+}
+
+
+// io61_reserve_shared(f, sz, tail)
+//    Try to reserve `sz` bytes at the tail of thread-safe file `f`'s
+//    buffer. On success, sets `*tail` to the reserved offset, registers
+//    the caller as a copying writer, and returns 1. Returns 0 if the
+//    buffer is sealed or too full.
+
+static int io61_reserve_shared(io61_file* f, size_t sz, uint64_t* tail) {
+    uint64_t st = atomic_load_explicit(&f->ts->state, memory_order_relaxed);
+    while (!(st & TS_SEALED) && TS_TAIL(st) + sz <= f->bufsize)
+        if (atomic_compare_exchange_weak_explicit(&f->ts->state, &st,
+                                                  st + sz + TS_WRITER,
+                                                  memory_order_acquire,
+                                                  memory_order_relaxed)) {
+            *tail = TS_TAIL(st);
+            return 1;
+        }
+    return 0;
+}
+
+static ssize_t io61_write_shared(io61_file* f, const char* buf, size_t sz) {
+    uint64_t tail;
+    if (!io61_reserve_shared(f, sz, &tail))
+        return io61_flush_shared(f, buf, sz);
+    memcpy(&f->buff[tail], buf, sz);
+    atomic_fetch_sub_explicit(&f->ts->state, TS_WRITER, memory_order_release);
+    return sz;
+}
+
+
+// io61_flush_shared(f, buf, sz)
+//    Slow path for thread-safe file `f`: under `lock`, write out the
+//    buffer, then append `buf[0..sz)` (buffering it if it fits). Returns
+//    `sz` on success and -1 on error.
+
+static ssize_t io61_flush_shared(io61_file* f, const char* buf, size_t sz) {
+    io61_shared* ts = f->ts;
+    pthread_mutex_lock(&ts->lock);
+
+    // Another thread may have emptied the buffer while we waited
+    uint64_t tail;
+    if (sz != 0 && io61_reserve_shared(f, sz, &tail)) {
+        pthread_mutex_unlock(&ts->lock);
+        memcpy(&f->buff[tail], buf, sz);
+        atomic_fetch_sub_explicit(&ts->state, TS_WRITER, memory_order_release);
+        return sz;
+    }
+
+    uint64_t st = atomic_fetch_or_explicit(&ts->state, TS_SEALED,
+                                           memory_order_acquire);
+    while (TS_NWRITERS(st) != 0) {
+        sched_yield();
+        st = atomic_load_explicit(&ts->state, memory_order_acquire);
+    }
+    int r = 0;
+    if (io61_write_fully(f->fd, f->buff, TS_TAIL(st)) < 0)
+        r = -1;
+    uint64_t newtail = 0;
+    if (sz > f->bufsize) {
+        if (io61_write_fully(f->fd, buf, sz) < 0)
+            r = -1;
+    } else if (sz != 0) {
+        memcpy(f->buff, buf, sz);
+        newtail = sz;
+    }
+    atomic_store_explicit(&ts->state, newtail, memory_order_release);
+
+    pthread_mutex_unlock(&ts->lock);
+    return r < 0 ? -1 : (ssize_t) sz;
+}
+
+
+// io61_set_checksum(f)
+//    Start computing a CRC32C checksum of the data passing through `f`:
+//    the characters returned by `io61_read`, `io61_readc` and
+//    `io61_read_until`, or accepted by `io61_write` and `io61_writec`,
+//    in that order. The checksum is updated on each chunk right after it
+//    is copied, while it is still in cache, so a copy can be verified
+//    without a second pass. `io61_read_batch` is not covered. Not
+//    available for thread-safe files. Returns 0 on success and -1 on
+//    failure.
+
+int io61_set_checksum(io61_file* f) {
+    if (f->ts)
+        return -1;
+    if (!crc32c_update)
+        crc32c_init();
+    f->checksumming = 1;
+    f->crc = 0xFFFFFFFF;
+    return 0;
+}
+
+
+// io61_checksum(f)
+//    Return the CRC32C of the data that has passed through `f` since
+//    `io61_set_checksum`.
+
+uint32_t io61_checksum(io61_file* f) {
+    return ~f->crc;
+}
+
+
+// io61_setvbuf(f, size, flags)
+//    Replace the cache buffer of `f` with one of `size` bytes. `flags` is
+//    a combination of IO61_BUF_HUGE (back the buffer with huge pages,
+//    which cuts TLB misses for multi-megabyte buffers) and
+//    IO61_BUF_PREFAULT (take the buffer's page faults now). Pending
+//    writes are flushed and cached reads are dropped first. Returns 0 on
+//    success and -1 on failure, in which case the old buffer is kept.
+
+int io61_setvbuf(io61_file* f, size_t size, int flags) {
+    if (size == 0 || f->wb || f->ts || f->z || f->pf)
+        return -1;
+    size_t mapsize;
+    char* buff = io61_buffer_alloc(size, flags, &mapsize);
+    if (!buff)
+        return -1;
+    io61_flush(f);
+    if (f->pos_tag != f->end_tag
+        && lseek(f->fd, f->pos_tag, SEEK_SET) != f->pos_tag) {
+        io61_buffer_free(buff, mapsize);
+        return -1;
+    }
+    io61_buffer_free(f->buff, f->mapsize);
+    f->buff = buff;
+    f->bufsize = size;
+    f->mapsize = mapsize;
+    f->bufflags = flags;
+    f->tag = f->end_tag = f->pos_tag;
+    return 0;
+}
+
+
+// io61_map_output(f, size)
+//    Switch output file `f` to mapped mode: truncate the file to `size`
+//    bytes and map it shared, so later writes are plain memory stores at
+//    the file position and seeks only move that position. Writes past
+//    `size` are cut short. The mapping is released by `io61_close`. `f`
+//    must be a regular file opened with O_RDWR (shared writable mappings
+//    need read access to the file). Returns 0 on success and -1 on
+//    failure, in which case `f` keeps working as a normal buffered file.
+
+int io61_map_output(io61_file* f, off_t size) {
+    struct stat s;
+    if (f->mode == O_RDONLY || f->outmap || f->wb || f->ts || f->z
+        || f->nonblocking || size <= 0
+        || fstat(f->fd, &s) < 0 || !S_ISREG(s.st_mode)
+        || (fcntl(f->fd, F_GETFL) & O_ACCMODE) != O_RDWR)
+        return -1;
+    io61_flush(f);
+    if (ftruncate(f->fd, size) < 0)
+        return -1;
+    char* map = (char*) mmap(NULL, size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED, f->fd, 0);
+    if (map == MAP_FAILED)
+        return -1;
+    f->outmap = map;
+    f->outsize = size;
+    return 0;
+}
+
+
+// lz_compress(src, n, dst)
+//    Compress `src[0..n)` into `dst`, which must have room for
+//    `ZBOUND(n)` bytes, and return the compressed size. `n` must be at
+//    most ZBLOCK. The format is a series of sequences, each a token byte
+//    (literal count in the high nibble, match length minus 4 in the low
+//    nibble; 15 means more length bytes follow, 255 meaning "keep
+//    going"), the literals, a 2-byte little-endian match offset, and any
+//    extra match length bytes. The last sequence has literals only.
+//    Matches are found with a single-probe hash table of 4-byte prefixes.
+
+#define LZ_HASHBITS 13
+#define LZ_MINMATCH 4
+#define LZ_LASTLITERALS 5   // Bytes at the end always sent as literals
+
+static uint32_t lz_read32(const unsigned char* p) {
+    uint32_t x;
+    memcpy(&x, p, 4);
+    return x;
+}
+
+static unsigned lz_hash(uint32_t x) {
+    return (x * 2654435761U) >> (32 - LZ_HASHBITS);
+}
+
+static unsigned char* lz_put_length(unsigned char* op, size_t len) {
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = len;
+    return op;
+}
+
+static unsigned char* lz_put_sequence(unsigned char* op,
+                                      const unsigned char* lit, size_t nlit,
+                                      size_t offset, size_t mlen) {
+    unsigned char* token = op++;
+    *token = (nlit < 15 ? nlit : 15) << 4;
+    if (nlit >= 15)
+        op = lz_put_length(op, nlit - 15);
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if (mlen != 0) {
+        *op++ = offset & 0xFF;
+        *op++ = offset >> 8;
+        mlen -= LZ_MINMATCH;
+        *token |= mlen < 15 ? mlen : 15;
+        if (mlen >= 15)
+            op = lz_put_length(op, mlen - 15);
+    }
+    return op;
+}
+
+static size_t lz_compress(const unsigned char* src, size_t n,
+                          unsigned char* dst) {
+    uint16_t table[1 << LZ_HASHBITS];   // Positions + 1; 0 means empty
+    memset(table, 0, sizeof(table));
+    assert(n <= ZBLOCK);
+    unsigned char* op = dst;
+    size_t anchor = 0, ip = 0;
+    size_t limit = n > LZ_LASTLITERALS + LZ_MINMATCH
+        ? n - LZ_LASTLITERALS - LZ_MINMATCH : 0;
+    while (ip < limit) {
+        uint32_t seq = lz_read32(&src[ip]);
+        unsigned h = lz_hash(seq);
+        size_t ref = table[h];
+        table[h] = ip + 1 < ZBLOCK ? ip + 1 : 0;
+        if (ref == 0 || lz_read32(&src[ref - 1]) != seq) {
+            ++ip;
+            continue;
+        }
+        --ref;
+        size_t mlen = LZ_MINMATCH;
+        while (ip + mlen < n - LZ_LASTLITERALS
+               && src[ref + mlen] == src[ip + mlen])
+            ++mlen;
+        op = lz_put_sequence(op, &src[anchor], ip - anchor, ip - ref, mlen);
+        ip += mlen;
+        anchor = ip;
+    }
+    op = lz_put_sequence(op, &src[anchor], n - anchor, 0, 0);
+    return op - dst;
+}
+
+
+// lz_decompress(src, n, dst, cap)
+//    Decompress `src[0..n)` into `dst`, which has room for `cap` bytes.
+//    Returns the decompressed size, or -1 if the input is malformed.
+
+static ssize_t lz_get_length(const unsigned char* src, size_t n, size_t* ip,
+                             size_t len) {
+    unsigned char b;
+    do {
+        if (*ip == n)
+            return -1;
+        b = src[*ip];
+        ++*ip;
+        len += b;
+    } while (b == 255);
+    return len;
+}
+
+static ssize_t lz_decompress(const unsigned char* src, size_t n,
+                             unsigned char* dst, size_t cap) {
+    size_t ip = 0, op = 0;
+    while (ip != n) {
+        unsigned token = src[ip];
+        ++ip;
+        ssize_t nlit = token >> 4;
+        if (nlit == 15 && (nlit = lz_get_length(src, n, &ip, nlit)) < 0)
+            return -1;
+        if ((size_t) nlit > n - ip || (size_t) nlit > cap - op)
+            return -1;
+        memcpy(&dst[op], &src[ip], nlit);
+        ip += nlit;
+        op += nlit;
+        if (ip == n)
+            break;
+
+        if (n - ip < 2)
+            return -1;
+        size_t offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        ssize_t mlen = token & 15;
+        if (mlen == 15 && (mlen = lz_get_length(src, n, &ip, mlen)) < 0)
+            return -1;
+        mlen += LZ_MINMATCH;
+        if (offset == 0 || offset > op || (size_t) mlen > cap - op)
+            return -1;
+        if (offset >= (size_t) mlen)
+            memcpy(&dst[op], &dst[op - offset], mlen);
+        else
+            for (ssize_t i = 0; i != mlen; ++i)
+                dst[op + i] = dst[op + i - offset];
+        op += mlen;
+    }
+    return op;
+}
+
+
+// io61_set_compressed(f)
+//    Put `f` in compressed mode. Data written to `f` is cut into
+//    ZBLOCK-byte blocks, each compressed with `lz_compress` and written
+//    as one frame (blocks that do not shrink are stored as is). Reading
+//    decompresses frame by frame. Seeking is supported when reading a
+//    seekable file: frame headers are indexed as they are seen, and
+//    `io61_seek` skips from header to header, without decompressing,
+//    until it reaches the frame holding the target. Output files can
+//    only be written sequentially. Must be called before any data is
+//    read or written, and excludes mapped output, write-behind,
+//    thread-safe and prefetch modes, and later `io61_setvbuf` calls.
+//    Returns 0 on success and -1 on failure.
+
+static int io61_zindex_add(io61_zstate* z, off_t raw_off, off_t file_off);
+
+int io61_set_compressed(io61_file* f) {
+    if (f->z || f->outmap || f->wb || f->ts || f->pf || f->nonblocking
+        || f->pos_tag != 0
+        || f->end_tag != 0)
+        return -1;
+    if (f->bufsize != ZBLOCK && io61_setvbuf(f, ZBLOCK, f->bufflags) < 0)
+        return -1;
+    io61_zstate* z = (io61_zstate*) malloc(sizeof(io61_zstate));
+    if (!z)
+        return -1;
+    z->zbuf = (unsigned char*) malloc(ZBOUND(ZBLOCK));
+    if (!z->zbuf) {
+        free(z);
+        return -1;
+    }
+    z->next_file_off = 0;
+    z->index = NULL;
+    z->nindex = z->capindex = 0;
+    z->index_end = 0;
+    z->index_complete = 0;
+    f->z = z;
+    return 0;
+}
+
+
+// io61_zwriteout(f)
+//    Compress the buffered data of output file `f` and write it as one
+//    frame. Returns 0 on success and -1 on error.
+
+static int io61_zwriteout(io61_file* f) {
+    io61_zstate* z = f->z;
+    uint32_t hdr[2];
+    hdr[0] = f->end_tag - f->tag;
+    hdr[1] = lz_compress((unsigned char*) f->buff, hdr[0], z->zbuf);
+    const char* payload = (const char*) z->zbuf;
+    if (hdr[1] >= hdr[0]) {
+        payload = f->buff;
+        hdr[1] = hdr[0] | ZSTORED;
+    }
+    size_t plen = hdr[1] & ~ZSTORED;
+    if (io61_write_fully(f->fd, (const char*) hdr, sizeof(hdr)) < 0
+        || io61_write_fully(f->fd, payload, plen) < 0)
+        return -1;
+    return 0;
+}
+
+
+// io61_read_fully(fd, buf, sz)
+//    Read `sz` bytes from `fd` into `buf`, retrying short reads. Returns
+//    the number of bytes read, which is less than `sz` only at end of
+//    file, or -1 on error.
+
+static ssize_t io61_read_fully(int fd, char* buf, size_t sz) {
+    size_t pos = 0;
+    while (pos != sz) {
+        ssize_t n = read(fd, buf + pos, sz - pos);
+        if (n > 0)
+            pos += n;
+        else if (n == 0)
+            break;
+        else if (errno != EINTR)
+            return -1;
+    }
+    return pos;
+}
+
+
+// io61_zfill(f)
+//    Read and decompress the next frame of compressed file `f` into its
+//    buffer. Same return values as `io61_fill`; a malformed frame is an
+//    error with `errno` set to EIO, and failing to grow the frame index
+//    is an error with `errno` set to ENOMEM.
+
+static ssize_t io61_zfill(io61_file* f) {
+    io61_zstate* z = f->z;
+    f->tag = f->end_tag;
+    uint32_t hdr[2];
+    ssize_t n = io61_read_fully(f->fd, (char*) hdr, sizeof(hdr));
+    if (n <= 0)
+        return n;
+    size_t plen = hdr[1] & ~ZSTORED;
+    if (n != sizeof(hdr) || hdr[0] == 0 || hdr[0] > f->bufsize
+        || plen > ZBOUND(ZBLOCK)) {
+        errno = EIO;
+        return -1;
+    }
+    char* dst = hdr[1] & ZSTORED ? f->buff : (char*) z->zbuf;
+    if (io61_read_fully(f->fd, dst, plen) != (ssize_t) plen) {
+        errno = EIO;
+        return -1;
+    }
+    if (!(hdr[1] & ZSTORED)
+        && lz_decompress(z->zbuf, plen, (unsigned char*) f->buff,
+                         f->bufsize) != hdr[0]) {
+        errno = EIO;
+        return -1;
+    }
+    if (f->tag == z->index_end && !z->index_complete) {
+        if (io61_zindex_add(z, f->tag, z->next_file_off) < 0)
+            return -1;
+        z->index_end += hdr[0];
+    }
+    z->next_file_off += sizeof(hdr) + plen;
+    f->end_tag += hdr[0];
+    return hdr[0];
+}
+
+
+// io61_zindex_add(z, raw_off, file_off)
+//    Append a frame to the index of `z`. Returns 0 on success and -1,
+//    leaving the index unchanged, if memory is exhausted.
+
+static int io61_zindex_add(io61_zstate* z, off_t raw_off, off_t file_off) {
+    if (z->nindex == z->capindex) {
+        size_t capindex = z->capindex ? 2 * z->capindex : 64;
+        io61_zframe* index = (io61_zframe*)
+            realloc(z->index, capindex * sizeof(io61_zframe));
+        if (!index) {
+            errno = ENOMEM;
+            return -1;
+        }
+        z->index = index;
+        z->capindex = capindex;
+    }
+    z->index[z->nindex].raw_off = raw_off;
+    z->index[z->nindex].file_off = file_off;
+    ++z->nindex;
+    return 0;
+}
+
+
+// io61_zindex_extend(f, off)
+//    Extend the frame index of compressed file `f` until it covers
+//    stream offset `off` or the whole file, reading only frame headers.
+//    Returns 0 on success and -1 on error. Moves the file position.
+
+static int io61_zindex_extend(io61_file* f, off_t off) {
+    io61_zstate* z = f->z;
+    off_t file_off = z->nindex
+        ? z->index[z->nindex - 1].file_off : 0;
+    if (z->nindex) {
+        // Skip the last indexed frame to reach the first unindexed one
+        uint32_t hdr[2];
+        if (pread(f->fd, hdr, sizeof(hdr), file_off) != sizeof(hdr))
+            return -1;
+        file_off += sizeof(hdr) + (hdr[1] & ~ZSTORED);
+    }
+    while (!z->index_complete && z->index_end <= off) {
+        uint32_t hdr[2];
+        ssize_t n = pread(f->fd, hdr, sizeof(hdr), file_off);
+        if (n == 0) {
+            z->index_complete = 1;
+            break;
+        } else if (n != sizeof(hdr) || hdr[0] == 0) {
+            errno = EIO;
+            return -1;
+        }
+        if (io61_zindex_add(z, z->index_end, file_off) < 0)
+            return -1;
+        z->index_end += hdr[0];
+        file_off += sizeof(hdr) + (hdr[1] & ~ZSTORED);
+    }
+    return 0;
+}
+
+
+// io61_zseek(f, off)
+//    Seek compressed file `f` to stream offset `off`: find the frame
+//    holding `off` through the index, position the file at its header,
+//    and load it into the buffer.
+
+static int io61_zseek(io61_file* f, off_t off) {
+    io61_zstate* z = f->z;
+    if (f->mode != O_RDONLY)
+        return off == f->pos_tag ? 0 : -1;
+    if (off >= f->tag && off <= f->end_tag) {
+        f->pos_tag = off;
+        return 0;
+    }
+    if (off < 0 || io61_zindex_extend(f, off) < 0)
+        return -1;
+
+    // Binary search for the last frame starting at or before `off`
+    size_t lo = 0, hi = z->nindex;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (z->index[mid].raw_off <= off)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    if (z->nindex == 0 || off >= z->index_end) {
+        // Past the end: position after the last frame
+        off_t file_end = lseek(f->fd, 0, SEEK_END);
+        if (file_end < 0)
+            return -1;
+        z->next_file_off = file_end;
+        f->tag = f->end_tag = z->index_end;
+    } else {
+        z->next_file_off = z->index[lo].file_off;
+        if (lseek(f->fd, z->next_file_off, SEEK_SET) != z->next_file_off)
+            return -1;
+        f->tag = f->end_tag = z->index[lo].raw_off;
+        if (io61_zfill(f) <= 0)
+            return -1;
+    }
+    f->pos_tag = off;
+    return 0;
+}
+
+
+// io61_zfilesize(f)
+//    Return the uncompressed size of compressed input file `f`, or -1 if
+//    it is not seekable.
+
+static off_t io61_zfilesize(io61_file* f) {
+    if (f->mode != O_RDONLY || lseek(f->fd, 0, SEEK_CUR) < 0
+        || io61_zindex_extend(f, (off_t) (UINT64_MAX >> 1)) < 0)
+        return -1;
+    return f->z->index_end;
+}
+
+
 // io61_seek(f, pos)
 //    Change the file pointer for file `f` to `pos` bytes into the file.
 //    Returns 0 on success and -1 on failure.
 
+static int io61_zseek(io61_file* f, off_t off);
+
 int io61_seek(io61_file* f, off_t off) {
+    if (f->ts)
+        return -1;
+    if (f->z)
+        return io61_zseek(f, off);
+    if (f->outmap) {
+        f->pos_tag = off;
+        return 0;
+    }
     // if the offset is not contained in the parameters,
     // change the offset by the amount it is off by
     // if this change fails, return -1
-    if (off < f->tag || off > f->end_tag) {
-        off_t aligned_off = off - (off % BUF_SIZE);
+    if (f->mode != O_RDONLY
+        && (off < f->tag + f->flushed || off > f->end_tag)) {
+        // Output: write out the buffer, then start a new one at `off`
+        if (io61_flush(f) < 0 || lseek(f->fd, off, SEEK_SET) != off)
+            return -1;
+        f->tag = f->end_tag = off;
+    } else if (off < f->tag || off > f->end_tag) {
+        off_t aligned_off = off - (off % f->bufsize);
         off_t r = lseek(f->fd, aligned_off, SEEK_SET);
         if (r != aligned_off)
             return -1;
@@ -185,6 +1682,610 @@ int io61_seek(io61_file* f, off_t off) {
 }
 
 
+// io61_tell(f)
+//    Return the current file position of `f`, or -1 if it has none (in
+//    thread-safe mode, where each write lands at the end of the file).
+
+off_t io61_tell(io61_file* f) {
+    if (f->ts) {
+        errno = ESPIPE;
+        return -1;
+    }
+    return f->pos_tag;
+}
+
+
+// io61_read_batch(f, reqs, n)
+//    Read each of the `n` requests in `reqs` from `f`: `reqs[i].len`
+//    characters at offset `reqs[i].off` into `reqs[i].dst`. Sets
+//    `reqs[i].result` to the number of characters read (short at end of
+//    file) or -1 on error. Returns the total number of characters read,
+//    or -1 if an error occurred before any characters were read. Returns
+//    -1 without reading anything, with `errno` set to EINVAL or ENOMEM,
+//    if `n` is too large to sort. Does not change the file position of
+//    `f`.
+//    Requests are served in offset order. Requests already in the cache
+//    are copied out; the rest are merged into runs of adjacent (or nearly
+//    adjacent) ranges, and each run is read with a single `preadv` that
+//    scatters the data directly into the callers' buffers.
+
+static int io61_readreq_compare(const void* a, const void* b) {
+    const io61_readreq* ra = *(const io61_readreq* const*) a;
+    const io61_readreq* rb = *(const io61_readreq* const*) b;
+    return ra->off < rb->off ? -1 : ra->off > rb->off;
+}
+
+static ssize_t io61_read_run(io61_file* f, io61_readreq** run, size_t nrun);
+
+static ssize_t io61_read_batch_seek(io61_file* f, io61_readreq* reqs,
+                                    size_t n);
+
+ssize_t io61_read_batch(io61_file* f, io61_readreq* reqs, size_t n) {
+    if (f->z)
+        return io61_read_batch_seek(f, reqs, n);
+    if (n == 0)
+        return 0;
+    if (n > SIZE_MAX / sizeof(io61_readreq*)) {
+        errno = EINVAL;
+        return -1;
+    }
+    io61_readreq** order = (io61_readreq**) malloc(n * sizeof(io61_readreq*));
+    if (!order) {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (size_t i = 0; i != n; ++i)
+        order[i] = &reqs[i];
+    qsort(order, n, sizeof(io61_readreq*), io61_readreq_compare);
+
+    ssize_t total = 0;
+    int error = 0;
+    size_t i = 0;
+    while (i != n) {
+        io61_readreq* r = order[i];
+        if (r->off >= f->tag && (off_t) (r->off + r->len) <= f->end_tag) {
+            // Already cached
+            memcpy(r->dst, &f->buff[r->off - f->tag], r->len);
+            r->result = r->len;
+            total += r->len;
+            ++i;
+            continue;
+        }
+
+        // Collect a run of requests that one `preadv` can serve. Each
+        // hole costs an extra iovec, so leave room for two per request.
+        size_t j = i + 1;
+        off_t run_end = r->off + r->len;
+        while (j != n && 2 * (j - i) < IOV_MAX
+               && order[j]->off >= run_end
+               && order[j]->off - run_end <= BATCH_GAP) {
+            run_end = order[j]->off + order[j]->len;
+            ++j;
+        }
+
+        ssize_t nr = io61_read_run(f, &order[i], j - i);
+        if (nr >= 0)
+            total += nr;
+        else
+            error = 1;
+        i = j;
+    }
+
+    free(order);
+    return total || !error ? total : -1;
+}
+
+// io61_read_batch_seek(f, reqs, n)
+//    Serve a batch one request at a time with `io61_seek` and
+//    `io61_read`. Used for compressed files, whose file offsets do not
+//    match stream offsets.
+
+static ssize_t io61_read_batch_seek(io61_file* f, io61_readreq* reqs,
+                                    size_t n) {
+    ssize_t total = 0;
+    int error = 0;
+    for (size_t i = 0; i != n; ++i) {
+        if (io61_seek(f, reqs[i].off) < 0)
+            reqs[i].result = -1;
+        else
+            reqs[i].result = io61_read(f, reqs[i].dst, reqs[i].len);
+        if (reqs[i].result >= 0)
+            total += reqs[i].result;
+        else
+            error = 1;
+    }
+    return total || !error ? total : -1;
+}
+
+static ssize_t io61_read_run(io61_file* f, io61_readreq** run, size_t nrun) {
+    static char hole[BATCH_GAP];
+    struct iovec iov[IOV_MAX];
+    int niov = 0;
+    off_t pos = run[0]->off;
+    for (size_t k = 0; k != nrun; ++k) {
+        if (run[k]->off != pos) {
+            iov[niov].iov_base = hole;
+            iov[niov].iov_len = run[k]->off - pos;
+            ++niov;
+        }
+        iov[niov].iov_base = run[k]->dst;
+        iov[niov].iov_len = run[k]->len;
+        ++niov;
+        run[k]->result = 0;
+        pos = run[k]->off + run[k]->len;
+    }
+
+    // Issue `preadv` until the run is complete or the file ends, then
+    // credit each request with the bytes that landed in its range.
+    off_t start = run[0]->off;
+    off_t got_end = start;
+    struct iovec* iovp = iov;
+    while (niov != 0) {
+        ssize_t r = preadv(f->fd, iovp, niov, got_end);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0) {
+            if (r < 0 && got_end == start) {
+                for (size_t k = 0; k != nrun; ++k)
+                    run[k]->result = -1;
+                return -1;
+            }
+            break;
+        }
+        got_end += r;
+        while (niov != 0 && (size_t) r >= iovp->iov_len) {
+            r -= iovp->iov_len;
+            ++iovp;
+            --niov;
+        }
+        if (niov != 0) {
+            iovp->iov_base = (char*) iovp->iov_base + r;
+            iovp->iov_len -= r;
+        }
+    }
+
+    ssize_t total = 0;
+    for (size_t k = 0; k != nrun; ++k) {
+        if (got_end > run[k]->off) {
+            off_t end = run[k]->off + run[k]->len;
+            run[k]->result = (end < got_end ? end : got_end) - run[k]->off;
+        }
+        total += run[k]->result;
+    }
+    return total;
+}
+
+
+// io61_iszero(p, n)
+//    Return 1 if `p[0..n)` is all zero bytes. Compares the block against
+//    itself shifted by one byte, so the work is done by the C library's
+//    vectorized `memcmp`.
+
+static int io61_iszero(const char* p, size_t n) {
+    return n == 0 || (p[0] == 0 && memcmp(p, p + 1, n - 1) == 0);
+}
+
+
+// io61_skip(f, len, oldsize)
+//    Advance output file `f` past `len` zero bytes without writing them,
+//    leaving a hole. Where the skipped range overlaps the old contents of
+//    the file (the first `oldsize` bytes), those contents are punched out
+//    with fallocate, or overwritten with zeros if the file system cannot
+//    punch holes. Returns 0 on success and -1 on failure.
+
+static int io61_skip(io61_file* f, off_t len, off_t oldsize) {
+    off_t off = f->pos_tag;
+    if (off < oldsize) {
+        off_t plen = oldsize - off < len ? oldsize - off : len;
+        if (io61_flush(f) < 0)
+            return -1;
+        if (fallocate(f->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      off, plen) < 0) {
+            static const char zeros[PAGESIZE];
+            for (off_t n = 0; n < plen; n += PAGESIZE)
+                if (io61_write(f, zeros, plen - n < PAGESIZE ? plen - n
+                               : PAGESIZE) < 0)
+                    return -1;
+        }
+    }
+    return io61_seek(f, off + len);
+}
+
+
+// io61_copy(inf, outf, flags)
+//    Copy the rest of `inf` to `outf`. Returns the number of characters
+//    copied, or -1 if an error occurred before any were copied.
+//    With IO61_COPY_SPARSE, runs of zeros become holes in `outf`. Holes
+//    in `inf` are found with SEEK_DATA/SEEK_HOLE and skipped without
+//    reading; data regions (and inputs that cannot report holes, like
+//    pipes) are also checked page by page for all-zero blocks. Holes are
+//    made by seeking past them, punching out any old data they overlap,
+//    and `outf` is extended with ftruncate if it ends in a hole. If
+//    `outf` cannot seek (e.g., it is a pipe or in thread-safe, mapped or
+//    compressed mode), zeros are written out as usual.
+//    Otherwise, if either file is a pipe, the data is moved with
+//    splice(2) and never enters user space (see `io61_splice_copy`).
+
+static int io61_spliceable(io61_file* f);
+static int io61_is_pipe(io61_file* f);
+static ssize_t io61_drain(io61_file* inf, io61_file** outfs, int noutfs);
+static ssize_t io61_splice_copy(io61_file* inf, io61_file* outf);
+
+ssize_t io61_copy(io61_file* inf, io61_file* outf, int flags) {
+    int sparse = (flags & IO61_COPY_SPARSE) != 0;
+    struct stat st;
+    off_t oldsize = 0;
+    size_t ncopied = 0;
+    if (sparse && (outf->ts || outf->outmap || outf->z || outf->nonblocking
+                   || outf->checksumming || fstat(outf->fd, &st) < 0
+                   || !S_ISREG(st.st_mode)))
+        sparse = 0;
+    else if (sparse)
+        oldsize = st.st_size;
+    if (!sparse && (io61_is_pipe(inf) || io61_is_pipe(outf))
+        && io61_spliceable(inf) && io61_spliceable(outf)) {
+        ssize_t ncached = io61_drain(inf, &outf, 1);
+        if (ncached < 0)
+            return -1;
+        ssize_t n = io61_splice_copy(inf, outf);
+        if (n >= 0 || errno != EINVAL)
+            return n >= 0 ? ncached + n : (ncached ? ncached : -1);
+        // splice refused these files; fall back to copying, counting
+        // the cached data already written
+        ncopied = ncached;
+    }
+
+    int seekdata = sparse && !inf->z && !inf->checksumming
+        && fstat(inf->fd, &st) == 0 && S_ISREG(st.st_mode);
+    off_t hole = 0;     // End of the input data region found by SEEK_DATA
+
+    int skipped = 0, error = 0;
+    while (!error) {
+        // Holes in the input: skip to the next data region
+        if (seekdata && inf->pos_tag == inf->end_tag
+            && inf->pos_tag >= hole) {
+            off_t data = lseek(inf->fd, inf->pos_tag, SEEK_DATA);
+            if (data < 0 && errno == ENXIO)
+                data = st.st_size;
+            if (data >= 0 && data < st.st_size
+                && (hole = lseek(inf->fd, data, SEEK_HOLE)) < 0)
+                hole = st.st_size;
+            if (data < 0)
+                seekdata = 0;
+            else if (data > inf->pos_tag) {
+                ncopied += data - inf->pos_tag;
+                skipped = 1;
+                if (io61_skip(outf, data - inf->pos_tag, oldsize) < 0)
+                    error = 1;
+                inf->tag = inf->end_tag = inf->pos_tag = data;
+            }
+            // Put the descriptor back where `io61_fill` expects it
+            if (lseek(inf->fd, inf->end_tag, SEEK_SET) < 0)
+                error = 1;
+            if (data >= st.st_size || error)
+                break;
+        }
+
+        if (inf->pos_tag == inf->end_tag) {
+            ssize_t n = io61_fill(inf);
+            if (n <= 0) {
+                error = n < 0;
+                break;
+            }
+        }
+
+        // Copy the cached data, skipping zero pages if sparse
+        const char* p = &inf->buff[inf->pos_tag - inf->tag];
+        size_t len = inf->end_tag - inf->pos_tag;
+        if (inf->checksumming)
+            inf->crc = crc32c_update(inf->crc, (const unsigned char*) p, len);
+        while (len != 0 && !error) {
+            size_t n = len < PAGESIZE ? len : PAGESIZE;
+            if (sparse && io61_iszero(p, n)) {
+                // Extend across following zero pages
+                while (n < len) {
+                    size_t m = len - n < PAGESIZE ? len - n : PAGESIZE;
+                    if (!io61_iszero(p + n, m))
+                        break;
+                    n += m;
+                }
+                skipped = 1;
+                error = io61_skip(outf, n, oldsize) < 0;
+            } else if (sparse) {
+                while (n < len && n < COPY_CHUNK) {
+                    size_t m = len - n < PAGESIZE ? len - n : PAGESIZE;
+                    if (io61_iszero(p + n, m))
+                        break;
+                    n += m;
+                }
+                error = io61_write(outf, p, n) != (ssize_t) n;
+            } else {
+                n = len;
+                error = io61_write(outf, p, n) != (ssize_t) n;
+            }
+            if (!error) {
+                p += n;
+                len -= n;
+                inf->pos_tag += n;
+                ncopied += n;
+            }
+        }
+    }
+
+    // A trailing hole needs the file extended to its full length
+    if (skipped && !error && io61_flush(outf) == 0
+        && fstat(outf->fd, &st) == 0 && st.st_size < outf->pos_tag
+        && ftruncate(outf->fd, outf->pos_tag) < 0)
+        error = 1;
+    return ncopied || !error ? (ssize_t) ncopied : -1;
+}
+
+
+// io61_spliceable(f)
+//    Return 1 if `f`'s data can be moved by the kernel without passing
+//    through its cache: it must not compress, checksum or map its data,
+//    share its position between threads, or be nonblocking.
+
+static int io61_spliceable(io61_file* f) {
+    return !f->z && !f->ts && !f->outmap && !f->checksumming
+        && !f->nonblocking;
+}
+
+
+// io61_is_pipe(f)
+//    Return 1 if `f` is a pipe or FIFO.
+
+static int io61_is_pipe(io61_file* f) {
+    struct stat st;
+    return fstat(f->fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+
+// io61_drain(inf, outfs, noutfs)
+//    Write the data cached in `inf` past its file position to each of
+//    the `noutfs` files in `outfs`, then flush them, so that the
+//    descriptors are positioned for copying by the kernel. Returns the
+//    number of characters drained or -1 on error.
+
+static ssize_t io61_drain(io61_file* inf, io61_file** outfs, int noutfs) {
+    size_t n = inf->end_tag - inf->pos_tag;
+    const char* p = &inf->buff[inf->pos_tag - inf->tag];
+    for (int i = 0; i != noutfs; ++i)
+        if ((n && io61_write(outfs[i], p, n) != (ssize_t) n)
+            || io61_flush(outfs[i]) < 0)
+            return -1;
+    inf->pos_tag = inf->end_tag;
+    // Prefetching readers use pread, so put the descriptor where
+    // splice will expect it
+    if (inf->pf && lseek(inf->fd, inf->end_tag, SEEK_SET) < 0)
+        return -1;
+    return n;
+}
+
+
+// io61_advance(f, n)
+//    Account for `n` characters moved through `f`'s descriptor by the
+//    kernel. `f`'s cache is empty.
+
+static void io61_advance(io61_file* f, size_t n) {
+    f->tag = f->end_tag = f->pos_tag = f->pos_tag + n;
+}
+
+
+// io61_splice_move(infd, outfd, n)
+//    Splice exactly `n` characters from `infd` to `outfd`. Returns 0 on
+//    success and -1 on error or early end of file.
+
+static int io61_splice_move(int infd, int outfd, size_t n) {
+    while (n != 0) {
+        ssize_t r = splice(infd, NULL, outfd, NULL, n, SPLICE_F_MOVE);
+        if (r > 0)
+            n -= r;
+        else if (r == 0 || errno != EINTR)
+            return -1;
+    }
+    return 0;
+}
+
+
+// io61_splice_copy(inf, outf)
+//    Copy the rest of `inf` to `outf` with splice(2), at least one of
+//    them being a pipe. Both caches must be empty. Returns the number of
+//    characters copied, or -1 if an error occurred before any were
+//    copied; `errno` is EINVAL if the kernel cannot splice these files.
+
+static ssize_t io61_splice_copy(io61_file* inf, io61_file* outf) {
+    size_t ncopied = 0;
+    while (1) {
+        ssize_t n = splice(inf->fd, NULL, outf->fd, NULL, SPLICE_CHUNK,
+                           SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n > 0) {
+            io61_advance(inf, n);
+            io61_advance(outf, n);
+            ncopied += n;
+        } else if (n == 0)
+            return ncopied;
+        else if (errno != EINTR)
+            return ncopied ? (ssize_t) ncopied : -1;
+    }
+}
+
+
+// io61_tee(inf, outfs, noutfs)
+//    Copy the rest of `inf` to each of the `noutfs` files in `outfs`.
+//    Returns the number of characters copied (to each output), or -1 if
+//    an error occurred before any were copied.
+//    If `inf` is a pipe, the data stays in the kernel: each round, tee(2)
+//    duplicates the next chunk of the pipe into a private pipe for every
+//    output but the last, those copies are spliced to their outputs, and
+//    the chunk itself is spliced to the last output. Other inputs are
+//    read through `inf`'s cache and written to every output.
+
+ssize_t io61_tee(io61_file* inf, io61_file** outfs, int noutfs) {
+    if (noutfs == 1)
+        return io61_copy(inf, outfs[0], 0);
+    int kernel = noutfs > 1 && io61_is_pipe(inf) && io61_spliceable(inf);
+    for (int i = 0; i != noutfs && kernel; ++i)
+        kernel = io61_spliceable(outfs[i]);
+
+    size_t ncopied = 0;
+    if (kernel) {
+        ssize_t n = io61_drain(inf, outfs, noutfs);
+        if (n < 0)
+            return -1;
+        ncopied = n;
+
+        int (*pipes)[2] = (int (*)[2]) malloc((noutfs - 1) * sizeof(int[2]));
+        int npipes = 0;
+        while (pipes && npipes != noutfs - 1
+               && pipe2(pipes[npipes], O_CLOEXEC) == 0)
+            ++npipes;
+        // Without private pipes, or if the kernel cannot tee this input,
+        // fall back to copying through the cache
+        int error = 0, fallback = npipes != noutfs - 1;
+        while (!fallback && !error) {
+            // Duplicate the chunk at the head of `inf` into each pipe.
+            // Every tee sees the same data, so each copies the same
+            // amount as the first.
+            ssize_t m = tee(inf->fd, pipes[0][1], SPLICE_CHUNK, 0);
+            if (m < 0 && errno == EINTR)
+                continue;
+            else if (m < 0) {
+                fallback = ncopied == (size_t) n && errno == EINVAL;
+                error = 1;
+                break;
+            } else if (m == 0)
+                break;
+            for (int i = 1; i != npipes && !error; ++i)
+                error = tee(inf->fd, pipes[i][1], m, 0) != m;
+            for (int i = 0; i != npipes && !error; ++i) {
+                error = io61_splice_move(pipes[i][0], outfs[i]->fd, m) < 0;
+                if (!error)
+                    io61_advance(outfs[i], m);
+            }
+            if (!error
+                && io61_splice_move(inf->fd, outfs[noutfs - 1]->fd, m) < 0)
+                error = 1;
+            if (!error) {
+                io61_advance(inf, m);
+                io61_advance(outfs[noutfs - 1], m);
+                ncopied += m;
+            }
+        }
+        for (int i = 0; i != npipes; ++i) {
+            close(pipes[i][0]);
+            close(pipes[i][1]);
+        }
+        free(pipes);
+        if (!fallback)
+            return ncopied || !error ? (ssize_t) ncopied : -1;
+    }
+
+    while (1) {
+        if (inf->pos_tag == inf->end_tag) {
+            ssize_t n = io61_fill(inf);
+            if (n <= 0)
+                return ncopied || n == 0 ? (ssize_t) ncopied : -1;
+        }
+        size_t n = inf->end_tag - inf->pos_tag;
+        const char* p = &inf->buff[inf->pos_tag - inf->tag];
+        if (inf->checksumming)
+            inf->crc = crc32c_update(inf->crc, (const unsigned char*) p, n);
+        for (int i = 0; i != noutfs; ++i)
+            if (io61_write(outfs[i], p, n) != (ssize_t) n)
+                return ncopied ? (ssize_t) ncopied : -1;
+        inf->pos_tag += n;
+        ncopied += n;
+    }
+}
+
+
+// io61_fstream(f)
+//    Return a stdio stream whose reads, writes and seeks go through
+//    io61 file `f`, so code written for `FILE*` gets io61's caching
+//    and whatever modes `f` is in. The stream is read-only or write-only
+//    to match `f`. Closing the stream closes `f`. Returns NULL on
+//    failure.
+//    The stream keeps stdio's own buffer, so `getc`-style calls stay
+//    cheap; large `fread`s and `fwrite`s bypass it and go straight to
+//    io61.
+
+static ssize_t io61_cookie_read(void* cookie, char* buf, size_t sz) {
+    return io61_read((io61_file*) cookie, buf, sz);
+}
+
+static ssize_t io61_cookie_write(void* cookie, const char* buf, size_t sz) {
+    ssize_t n = io61_write((io61_file*) cookie, buf, sz);
+    return n < 0 ? 0 : n;   // fopencookie wants 0 on error
+}
+
+static int io61_cookie_seek(void* cookie, off64_t* pos, int whence) {
+    io61_file* f = (io61_file*) cookie;
+    off_t base = 0;
+    if (whence == SEEK_CUR)
+        base = io61_tell(f);
+    else if (whence == SEEK_END) {
+        // The file size leaves out output that is still buffered
+        if (io61_flush(f) < 0)
+            return -1;
+        base = io61_filesize(f);
+    }
+    if (base < 0 || base + *pos < 0 || io61_seek(f, base + *pos) < 0)
+        return -1;
+    *pos = base + *pos;
+    return 0;
+}
+
+static int io61_cookie_close(void* cookie) {
+    return io61_close((io61_file*) cookie);
+}
+
+FILE* io61_fstream(io61_file* f) {
+    cookie_io_functions_t fns;
+    fns.read = f->mode == O_RDONLY ? io61_cookie_read : NULL;
+    fns.write = f->mode == O_RDONLY ? NULL : io61_cookie_write;
+    fns.seek = io61_cookie_seek;
+    fns.close = io61_cookie_close;
+    return fopencookie(f, f->mode == O_RDONLY ? "r" : "w", fns);
+}
+
+
+// io61_fopen(filename, mode)
+//    Like `fopen`, but the returned stream is backed by io61 (see
+//    `io61_fstream`). `mode` is "r", "w" or "a", optionally with "b";
+//    io61 files go one way only, so "+" modes fail with EINVAL.
+
+FILE* io61_fopen(const char* filename, const char* mode) {
+    int flags;
+    if (mode[0] == 'r')
+        flags = O_RDONLY;
+    else if (mode[0] == 'w')
+        flags = O_WRONLY | O_CREAT | O_TRUNC;
+    else if (mode[0] == 'a')
+        flags = O_WRONLY | O_CREAT | O_APPEND;
+    else {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (strchr(mode, '+')) {
+        errno = EINVAL;
+        return NULL;
+    }
+    int fd = open(filename, flags, 0666);
+    if (fd < 0)
+        return NULL;
+    io61_file* f = io61_fdopen(fd, flags & O_ACCMODE);
+    if (!f) {
+        close(fd);
+        return NULL;
+    }
+    FILE* stream = io61_fstream(f);
+    if (!stream)
+        io61_close(f);
+    return stream;
+}
+
+
 // You shouldn't need to change these functions.
 
 // io61_open_check(filename, mode)
@@ -205,7 +2306,13 @@ io61_file* io61_open_check(const char* filename, int mode) {
         fprintf(stderr, "%s: %s\n", filename, strerror(errno));
         exit(1);
     }
-    return io61_fdopen(fd, mode & O_ACCMODE);
+    io61_file* f = io61_fdopen(fd, mode & O_ACCMODE);
+    if (!f) {
+        fprintf(stderr, "%s: %s\n", filename ? filename : "io61_fdopen",
+                strerror(ENOMEM));
+        exit(1);
+    }
+    return f;
 }
 
 
@@ -213,7 +2320,11 @@ io61_file* io61_open_check(const char* filename, int mode) {
 //    Return the size of `f` in bytes. Returns -1 if `f` does not have a
 //    well-defined size (for instance, if it is a pipe).
 
+static off_t io61_zfilesize(io61_file* f);
+
 off_t io61_filesize(io61_file* f) {
+    if (f->z)
+        return io61_zfilesize(f);
     struct stat s;
     int r = fstat(f->fd, &s);
     if (r >= 0 && S_ISREG(s.st_mode))
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
 
 typedef struct io61_file io61_file;
 
@@ -16,6 +17,9 @@ int io61_close(io61_file* f);
 off_t io61_filesize(io61_file* f);
 
 int io61_seek(io61_file* f, off_t pos);
+off_t io61_tell(io61_file* f);
+
+int io61_map_output(io61_file* f, off_t size);
 
 int io61_readc(io61_file* f);
 int io61_writec(io61_file* f, int ch);
@@ -23,9 +27,47 @@ int io61_writec(io61_file* f, int ch);
 ssize_t io61_read(io61_file* f, char* buf, size_t sz);
 ssize_t io61_write(io61_file* f, const char* buf, size_t sz);
 
+ssize_t io61_read_until(io61_file* f, int delim, char* buf, size_t sz);
+ssize_t io61_readline(io61_file* f, char* buf, size_t sz);
+
+typedef struct io61_records io61_records;
+io61_records* io61_records_open(io61_file* f, size_t record_size);
+ssize_t io61_records_next(io61_records* r, const char** recp);
+void io61_records_close(io61_records* r);
+
+typedef struct io61_readreq {
+    off_t off;                  // file offset of the data to read
+    size_t len;                 // number of characters to read
+    char* dst;                  // where to put them
+    ssize_t result;             // set to number of characters read, or -1
+} io61_readreq;
+
+ssize_t io61_read_batch(io61_file* f, io61_readreq* reqs, size_t n);
+
 int io61_eof(io61_file* f);
+
+#define IO61_COPY_SPARSE    1   // turn runs of zeros into holes
+ssize_t io61_copy(io61_file* inf, io61_file* outf, int flags);
+ssize_t io61_tee(io61_file* inf, io61_file** outfs, int noutfs);
+
+FILE* io61_fstream(io61_file* f);
+FILE* io61_fopen(const char* filename, const char* mode);
 int io61_flush(io61_file* f);
 
+#define IO61_BUF_HUGE       1   // back the buffer with huge pages
+#define IO61_BUF_PREFAULT   2   // fault in the buffer's pages up front
+int io61_setvbuf(io61_file* f, size_t size, int flags);
+int io61_set_writebehind(io61_file* f, int nbuffers);
+int io61_set_threadsafe(io61_file* f);
+
+int io61_set_checksum(io61_file* f);
+uint32_t io61_checksum(io61_file* f);
+int io61_set_compressed(io61_file* f);
+int io61_set_nonblocking(io61_file* f);
+int io61_set_prefetch(io61_file* f);
+int io61_pollfd(io61_file* f);
+int io61_wants_write(io61_file* f);
+
 void io61_profile_begin(void);
 void io61_profile_end(void);
 
@@ -36,6 +78,8 @@ typedef struct {
     size_t stride;              // `-t` option: stride. Defaults to 1
     const char* output_file;    // `-o` option: output file. Defaults to NULL
     const char* input_file;     // input file. Defaults to NULL
+    int sparse;                 // `-z` option: preserve holes. Defaults to 0
+    const char* mix;            // `-m` option: workload mix. Defaults to NULL
     int n_input_files;          // number of input files; at least 1
     const char** input_files;   // all input files; NULL-terminated array
 } io61_arguments;
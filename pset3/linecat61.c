@@ -0,0 +1,37 @@
+#include "io61.h"
+
+// Usage: ./linecat61 [-b MAXLINESIZE] [-s SIZE] [-o OUTFILE] [FILE]
+//    Copies the input FILE to OUTFILE one line at a time. Lines longer
+//    than MAXLINESIZE are copied in MAXLINESIZE pieces.
+//    Default MAXLINESIZE is 4096.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args = io61_parse_arguments(argc, argv, "b:s:o:");
+    size_t max_linesize = args.block_size ? args.block_size : 4096;
+
+    // Allocate buffer, open files
+    char* buf = (char*) malloc(max_linesize);
+
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+
+    // Copy file data
+    while (args.input_size > 0) {
+        size_t m = max_linesize;
+        if (m > args.input_size)
+            m = args.input_size;
+        ssize_t amount = io61_readline(inf, buf, m);
+        if (amount <= 0)
+            break;
+        io61_write(outf, buf, amount);
+        args.input_size -= amount;
+    }
+
+    io61_close(inf);
+    io61_close(outf);
+    io61_profile_end();
+    free(buf);
+}
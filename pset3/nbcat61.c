@@ -0,0 +1,77 @@
+#include "io61.h"
+#include <errno.h>
+#include <poll.h>
+
+// Usage: ./nbcat61 [-b BLOCKSIZE] [-o OUTFILE] [FILE]
+//    Copies the input FILE to standard output in blocks, like blockcat61,
+//    but with both files in nonblocking mode. Whenever a read or write
+//    would block, waits with poll() for the input to become readable or
+//    for buffered output to become writable. Default BLOCKSIZE is 4096.
+
+static io61_file* inf;
+static io61_file* outf;
+
+// wait_ready(want_input)
+//    Block until the input is readable (if `want_input`) or the output
+//    can accept buffered data, and flush the output if it can.
+
+static void wait_ready(int want_input) {
+    struct pollfd pfd[2];
+    int n = 0;
+    if (want_input) {
+        pfd[n].fd = io61_pollfd(inf);
+        pfd[n].events = POLLIN;
+        ++n;
+    }
+    int outi = n;
+    if (io61_wants_write(outf)) {
+        pfd[n].fd = io61_pollfd(outf);
+        pfd[n].events = POLLOUT;
+        ++n;
+    }
+    if (n == 0 || poll(pfd, n, -1) < 0)
+        return;
+    if (outi != n && pfd[outi].revents != 0)
+        io61_flush(outf);
+}
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args = io61_parse_arguments(argc, argv, "b:o:");
+    size_t block_size = args.block_size ? args.block_size : 4096;
+
+    // Allocate buffer, open files
+    char* buf = (char*) malloc(block_size);
+
+    io61_profile_begin();
+    inf = io61_open_check(args.input_file, O_RDONLY);
+    outf = io61_open_check(args.output_file, O_WRONLY | O_CREAT | O_TRUNC);
+    io61_set_nonblocking(inf);
+    io61_set_nonblocking(outf);
+
+    // Copy file data
+    while (1) {
+        ssize_t amount = io61_read(inf, buf, block_size);
+        if (amount < 0 && errno == EAGAIN) {
+            wait_ready(1);
+            continue;
+        } else if (amount <= 0)
+            break;
+        ssize_t pos = 0;
+        while (pos != amount) {
+            ssize_t w = io61_write(outf, &buf[pos], amount - pos);
+            if (w > 0)
+                pos += w;
+            else if (w < 0 && errno == EAGAIN)
+                wait_ready(0);
+            else
+                goto done;
+        }
+    }
+
+ done:
+    io61_close(inf);
+    io61_close(outf);
+    io61_profile_end();
+    free(buf);
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE     // F_SETPIPE_SZ
 #include "io61.h"
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -22,17 +23,94 @@ static const struct message_set messages[] = {
     { 20, 10000, 10000 }
 };
 
+// Usage: ./pipeexchange61 [-l]
+//    Exchanges each message set once and exits with status 1 if the
+//    exchange takes more than 5 seconds. With -l, measures latency
+//    instead: each message set is exchanged LATENCY_ROUNDS times, and the
+//    deadline is 30 seconds.
+
+#define LATENCY_ROUNDS 200
+static int rounds = 1;
+static int measure_latency = 0;
+
 // Requester algorithm:
-//    for (i = 0; i < request_batch; ++i)
-//        send request of size request_size;
-//    for (i = 0; i < request_batch; ++i)
-//        receive reply;
+//    for (round = 0; round < rounds; ++round) {
+//        for (i = 0; i < request_batch; ++i)
+//            send request of size request_size;
+//        for (i = 0; i < request_batch; ++i)
+//            receive reply;
+//    }
 
 // Responder algorithm:
-//    for (i = 0; i < request_batch; ++i) {
-//        receive request;
-//        send reply of size response_size;
-//    }
+//    for (round = 0; round < rounds; ++round)
+//        for (i = 0; i < request_batch; ++i) {
+//            receive request;
+//            send reply of size response_size;
+//        }
+
+// Every request starts with its id and the CLOCK_MONOTONIC time it was
+// handed to io61; replies echo those bytes. With -l, the requester
+// records each round trip (from io61_write of the request to io61_read
+// of its reply) in a per-message-set latency histogram, and prints
+// percentiles and message rates at the end.
+
+
+// Latency histograms
+//    Log-linear, as in HdrHistogram: values below 2^HIST_SUBBITS
+//    nanoseconds get exact buckets, and each larger power-of-two range
+//    is split into 2^HIST_SUBBITS equal buckets, so every bucket is
+//    within about 3% of the values it holds.
+
+#define HIST_SUBBITS 5
+#define HIST_SUB (1 << HIST_SUBBITS)
+#define HIST_NBUCKETS ((64 - HIST_SUBBITS + 1) * HIST_SUB)
+
+typedef struct histogram {
+    uint64_t count;
+    uint64_t buckets[HIST_NBUCKETS];
+} histogram;
+
+static size_t hist_index(uint64_t v) {
+    if (v < HIST_SUB)
+        return v;
+    int shift = 63 - __builtin_clzll(v) - HIST_SUBBITS;
+    return (shift + 1) * HIST_SUB + (v >> shift) - HIST_SUB;
+}
+
+// hist_value(i)
+//    Return the largest value that lands in bucket `i`.
+static uint64_t hist_value(size_t i) {
+    if (i < HIST_SUB)
+        return i;
+    int shift = i / HIST_SUB - 1;
+    uint64_t m = i % HIST_SUB + HIST_SUB;
+    return ((m + 1) << shift) - 1;
+}
+
+static void hist_record(histogram* h, uint64_t v) {
+    ++h->buckets[hist_index(v)];
+    ++h->count;
+}
+
+static uint64_t hist_percentile(const histogram* h, double pct) {
+    uint64_t rank = (uint64_t) (pct / 100 * h->count + 0.999999);
+    uint64_t seen = 0;
+    for (size_t i = 0; i != HIST_NBUCKETS; ++i) {
+        seen += h->buckets[i];
+        if (seen >= rank && seen != 0)
+            return hist_value(i);
+    }
+    return 0;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Bytes at the start of each message: id, then send time
+#define HEADER_SIZE (2 * sizeof(uint64_t))
 
 
 static size_t max_message_size(void) {
@@ -40,6 +118,8 @@ static size_t max_message_size(void) {
     size_t sz = 0;
 
     for (size_t mindex = 0; mindex < nmessages; ++mindex) {
+        assert(messages[mindex].request_size >= HEADER_SIZE
+               && messages[mindex].response_size >= HEADER_SIZE);
         if (messages[mindex].request_size > sz)
             sz = messages[mindex].request_size;
         if (messages[mindex].response_size > sz)
@@ -56,31 +136,56 @@ void requester(io61_file* outf, io61_file* inf) {
     char* buf = (char*) malloc(maxsz);
     memset(buf, 0, maxsz);
 
-    size_t requestid = 0;
-    size_t responseid = 0;
-    size_t id;
+    uint64_t requestid = 0;
+    uint64_t responseid = 0;
+    uint64_t hdr[2];    // id, send time
+    histogram* hists = (histogram*) calloc(nmessages, sizeof(histogram));
+    uint64_t* phase_ns = (uint64_t*) calloc(nmessages, sizeof(uint64_t));
 
     for (size_t mindex = 0; mindex < nmessages; ++mindex) {
         const struct message_set* m = &messages[mindex];
-        printf("requester: phase %zd/%zd\n", mindex, nmessages);
-        for (int i = 0; i < m->request_batch; ++i) {
-            memcpy(buf, &requestid, sizeof(size_t));
-            ++requestid;
-            ssize_t r = io61_write(outf, buf, m->request_size);
-            assert((size_t) r == m->request_size);
-        }
-        int x = io61_flush(outf);
-        assert(x >= 0);
-        for (int i = 0; i < m->request_batch; ++i) {
-            ssize_t r = io61_read(inf, buf, m->response_size);
-            assert((size_t) r == m->response_size);
-            memcpy(&id, buf, sizeof(size_t));
-            assert(id == responseid);
-            ++responseid;
+        if (!measure_latency)
+            printf("requester: phase %zd/%zd\n", mindex, nmessages);
+        uint64_t phase_start = now_ns();
+        for (int round = 0; round < rounds; ++round) {
+            for (int i = 0; i < m->request_batch; ++i) {
+                hdr[0] = requestid;
+                hdr[1] = now_ns();
+                memcpy(buf, hdr, HEADER_SIZE);
+                ++requestid;
+                ssize_t r = io61_write(outf, buf, m->request_size);
+                assert((size_t) r == m->request_size);
+            }
+            int x = io61_flush(outf);
+            assert(x >= 0);
+            for (int i = 0; i < m->request_batch; ++i) {
+                ssize_t r = io61_read(inf, buf, m->response_size);
+                assert((size_t) r == m->response_size);
+                uint64_t now = now_ns();
+                memcpy(hdr, buf, HEADER_SIZE);
+                assert(hdr[0] == responseid);
+                ++responseid;
+                if (measure_latency)
+                    hist_record(&hists[mindex], now - hdr[1]);
+            }
         }
+        phase_ns[mindex] = now_ns() - phase_start;
     }
 
+    for (size_t mindex = 0; mindex < nmessages && measure_latency; ++mindex) {
+        const struct message_set* m = &messages[mindex];
+        const histogram* h = &hists[mindex];
+        printf("requester: phase %zu/%zu (%d x %zuB/%zuB): %llu msgs, "
+               "%.0f msgs/s, p50 %.1fus, p99 %.1fus, p999 %.1fus\n",
+               mindex, nmessages, m->request_batch, m->request_size,
+               m->response_size, (unsigned long long) h->count,
+               h->count / (phase_ns[mindex] / 1e9),
+               hist_percentile(h, 50) / 1e3, hist_percentile(h, 99) / 1e3,
+               hist_percentile(h, 99.9) / 1e3);
+    }
     printf("requester: done!\n");
+    free(hists);
+    free(phase_ns);
     io61_close(inf);
     io61_close(outf);
     free(buf);
@@ -95,14 +200,15 @@ void responder(io61_file* outf, io61_file* inf) {
 
     for (size_t mindex = 0; mindex < nmessages; ++mindex) {
         const struct message_set* m = &messages[mindex];
-        for (int i = 0; i < m->request_batch; ++i) {
-            ssize_t r = io61_read(inf, buf, m->request_size);
-            assert((size_t) r == m->request_size);
-            r = io61_write(outf, buf, m->response_size);
-            assert((size_t) r == m->response_size);
-            int x = io61_flush(outf);
-            assert(x >= 0);
-        }
+        for (int round = 0; round < rounds; ++round)
+            for (int i = 0; i < m->request_batch; ++i) {
+                ssize_t r = io61_read(inf, buf, m->request_size);
+                assert((size_t) r == m->request_size);
+                r = io61_write(outf, buf, m->response_size);
+                assert((size_t) r == m->response_size);
+                int x = io61_flush(outf);
+                assert(x >= 0);
+            }
     }
 
     io61_close(inf);
@@ -112,7 +218,16 @@ void responder(io61_file* outf, io61_file* inf) {
 }
 
 int main(int argc, char* argv[]) {
-    (void) argc, (void) argv;
+    int opt;
+    while ((opt = getopt(argc, argv, "l")) != -1)
+        if (opt == 'l') {
+            measure_latency = 1;
+            rounds = LATENCY_ROUNDS;
+        } else {
+            fprintf(stderr, "Usage: %s [-l]\n", argv[0]);
+            exit(1);
+        }
+    int deadline = measure_latency ? 30 : 5;
 
     // create a connected socket pair for communicating between processes
     int request_fds[2], response_fds[2];
@@ -121,6 +236,12 @@ int main(int argc, char* argv[]) {
         perror("pipe");
         exit(1);
     }
+#ifdef F_SETPIPE_SZ
+    // A batch of 20 10000-byte messages overflows the default 64KB pipe
+    // while the other side is blocked writing replies; make room for it
+    fcntl(request_fds[1], F_SETPIPE_SZ, 1 << 20);
+    fcntl(response_fds[1], F_SETPIPE_SZ, 1 << 20);
+#endif
 
     // fork two children
     pid_t p1 = fork();
@@ -146,7 +267,7 @@ int main(int argc, char* argv[]) {
     }
 
     time_t start_time = time(0);
-    while ((p1 > 0 || p2 > 0) && time(0) < start_time + 5) {
+    while ((p1 > 0 || p2 > 0) && time(0) < start_time + deadline) {
         int status;
         if (p1 > 0 && waitpid(p1, &status, WNOHANG) == p1) {
             printf("requester exits with status %d\n",
@@ -2,16 +2,100 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <errno.h>
+#if __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
 
 // profile61.c
 //    The profile functions measure how much time and memory are used
 //    by your code. The io61_profile_end() function prints a simple
 //    report to standard error. The io61_parse_arguments() function
 //    parses common arguments into a structure.
+//
+//    If the IO61_PERF environment variable is set (and not "0"), the
+//    report also includes hardware and software event counts for the
+//    profiled region, collected with perf_event_open. Counters the
+//    kernel refuses to provide are left out of the report.
 
 static struct timeval tv_begin;
 
+#if __linux__
+static struct perf_counter {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+    int fd;
+} perf_counters[] = {
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1 },
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1 },
+    { "cachemisses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, -1 },
+    { "pagefaults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, -1 },
+    { "ctxswitches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, -1 }
+};
+#define NPERF_COUNTERS (sizeof(perf_counters) / sizeof(perf_counters[0]))
+
+// perf_begin()
+//    Open and start the counters in `perf_counters`. Counters are
+//    inherited by child processes, so tests that fork are fully counted.
+
+static void perf_begin(void) {
+    const char* env = getenv("IO61_PERF");
+    if (!env || !*env || strcmp(env, "0") == 0)
+        return;
+    for (size_t i = 0; i != NPERF_COUNTERS; ++i) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_counters[i].type;
+        attr.config = perf_counters[i].config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+            | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        perf_counters[i].fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+                                      PERF_FLAG_FD_CLOEXEC);
+    }
+    for (size_t i = 0; i != NPERF_COUNTERS; ++i)
+        if (perf_counters[i].fd >= 0)
+            ioctl(perf_counters[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+// perf_end(buf, len)
+//    Stop the counters and append their values to the JSON object in
+//    `buf`, which currently holds `len` characters ending in "}\n".
+//    Values are scaled up if the kernel had to multiplex the counters.
+//    Returns the new length.
+
+static int perf_end(char* buf, int len) {
+    for (size_t i = 0; i != NPERF_COUNTERS; ++i)
+        if (perf_counters[i].fd >= 0)
+            ioctl(perf_counters[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+    for (size_t i = 0; i != NPERF_COUNTERS; ++i) {
+        uint64_t v[3];  // value, time enabled, time running
+        if (perf_counters[i].fd < 0)
+            continue;
+        if (read(perf_counters[i].fd, v, sizeof(v)) == sizeof(v)
+            && v[2] != 0) {
+            if (v[2] < v[1])
+                v[0] = (double) v[0] * v[1] / v[2];
+            len += sprintf(buf + len - 2, ", \"%s\":%llu}\n",
+                           perf_counters[i].name,
+                           (unsigned long long) v[0]) - 2;
+        }
+        close(perf_counters[i].fd);
+        perf_counters[i].fd = -1;
+    }
+    return len;
+}
+#endif
+
 void io61_profile_begin(void) {
+#if __linux__
+    perf_begin();
+#endif
     int r = gettimeofday(&tv_begin, 0);
     assert(r >= 0);
 }
@@ -32,11 +116,16 @@ void io61_profile_end(void) {
     timeradd(&usage.ru_stime, &cusage.ru_stime, &usage.ru_stime);
 
     char buf[1000];
-    int len = sprintf(buf, "{\"time\":%ld.%06ld, \"utime\":%ld.%06ld, \"stime\":%ld.%06ld, \"maxrss\":%ld}\n",
+    int len = sprintf(buf, "{\"time\":%ld.%06ld, \"utime\":%ld.%06ld, \"stime\":%ld.%06ld, \"maxrss\":%ld, \"minflt\":%ld, \"majflt\":%ld}\n",
                       tv_end.tv_sec, (long) tv_end.tv_usec,
                       usage.ru_utime.tv_sec, (long) usage.ru_utime.tv_usec,
                       usage.ru_stime.tv_sec, (long) usage.ru_stime.tv_usec,
-                      usage.ru_maxrss + cusage.ru_maxrss);
+                      usage.ru_maxrss + cusage.ru_maxrss,
+                      usage.ru_minflt + cusage.ru_minflt,
+                      usage.ru_majflt + cusage.ru_majflt);
+#if __linux__
+    len = perf_end(buf, len);
+#endif
 
     // Print the report to file descriptor 100 if it's available. Our
     // `check.pl` test harness uses this file descriptor.
@@ -54,6 +143,8 @@ io61_arguments io61_parse_arguments(int argc, char* argv[], const char* opts) {
     args.input_size = -1;
     args.block_size = 0;
     args.stride = 1024;
+    args.sparse = 0;
+    args.mix = NULL;
     args.output_file = args.input_file = NULL;
     args.input_files = NULL;
 
@@ -86,6 +177,12 @@ io61_arguments io61_parse_arguments(int argc, char* argv[], const char* opts) {
         case 'o':
             args.output_file = optarg;
             break;
+        case 'z':
+            args.sparse = 1;
+            break;
+        case 'm':
+            args.mix = optarg;
+            break;
         case '#':
             break;
         default:
@@ -112,6 +209,10 @@ io61_arguments io61_parse_arguments(int argc, char* argv[], const char* opts) {
         fprintf(stderr, " [-t STRIDE]");
     if (strchr(opts, 'o'))
         fprintf(stderr, " [-o OUTFILE]");
+    if (strchr(opts, 'z'))
+        fprintf(stderr, " [-z]");
+    if (strchr(opts, 'm'))
+        fprintf(stderr, " [-m MIX]");
     if (strchr(opts, '#'))
         fprintf(stderr, " [FILE...]\n");
     else
@@ -0,0 +1,39 @@
+#include "io61.h"
+
+// Usage: ./recordcat61 [-b RECORDSIZE] [-s SIZE] [-o OUTFILE] [FILE]
+//    Copies the input FILE to OUTFILE one fixed-size record at a time,
+//    using the `io61_records` iterator. A final partial record is copied
+//    as is. Default RECORDSIZE is 100.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args = io61_parse_arguments(argc, argv, "b:s:o:");
+    size_t record_size = args.block_size ? args.block_size : 100;
+
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+    io61_records* records = io61_records_open(inf, record_size);
+    if (!records) {
+        fprintf(stderr, "recordcat61: cannot iterate over records\n");
+        exit(1);
+    }
+
+    // Copy file data
+    while (args.input_size > 0) {
+        const char* rec;
+        ssize_t amount = io61_records_next(records, &rec);
+        if (amount <= 0)
+            break;
+        if ((size_t) amount > args.input_size)
+            amount = args.input_size;
+        io61_write(outf, rec, amount);
+        args.input_size -= amount;
+    }
+
+    io61_records_close(records);
+    io61_close(inf);
+    io61_close(outf);
+    io61_profile_end();
+}
@@ -5,6 +5,11 @@
 //    Copies the input FILE to OUTFILE in blocks. The blocks are
 //    transferred in random order, but the resulting output file
 //    should be the same as the input. Default BLOCKSIZE is 4096.
+//    Blocks are read in batches of up to BATCHSIZE with io61_read_batch,
+//    then written one at a time in the order they were chosen. The
+//    output is mapped with io61_map_output when possible.
+
+#define BATCHSIZE 64
 
 int main(int argc, char* argv[]) {
     // Parse arguments
@@ -13,7 +18,8 @@ int main(int argc, char* argv[]) {
     size_t block_size = args.block_size ? args.block_size : 4096;
 
     // Allocate buffer, open files, measure file sizes
-    char* buf = (char*) malloc(block_size);
+    char* buf = (char*) malloc(block_size * BATCHSIZE);
+    io61_readreq reqs[BATCHSIZE];
 
     io61_profile_begin();
     io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
@@ -30,11 +36,12 @@ int main(int argc, char* argv[]) {
     }
 
     io61_file* outf = io61_open_check(args.output_file,
-                                      O_WRONLY | O_CREAT | O_TRUNC);
+                                      O_RDWR | O_CREAT | O_TRUNC);
     if (io61_seek(outf, 0) < 0) {
         fprintf(stderr, "reordercat61: output file is not seekable\n");
         exit(1);
     }
+    io61_map_output(outf, args.input_size);
 
     // Calculate random permutation of file's blocks
     size_t nblocks = args.input_size / block_size;
@@ -51,20 +58,30 @@ int main(int argc, char* argv[]) {
         blockpos[i] = i;
 
     // Copy file data
-    while (nblocks != 0) {
-        // Choose block to read
-        size_t index = random() % nblocks;
-        size_t pos = blockpos[index] * block_size;
-        blockpos[index] = blockpos[nblocks - 1];
-        --nblocks;
+    int done = 0;
+    while (nblocks != 0 && !done) {
+        // Choose a batch of blocks to read
+        size_t nreqs = 0;
+        while (nblocks != 0 && nreqs != BATCHSIZE) {
+            size_t index = random() % nblocks;
+            reqs[nreqs].off = blockpos[index] * block_size;
+            reqs[nreqs].len = block_size;
+            reqs[nreqs].dst = &buf[nreqs * block_size];
+            blockpos[index] = blockpos[nblocks - 1];
+            --nblocks;
+            ++nreqs;
+        }
 
-        // Transfer that block
-        io61_seek(inf, pos);
-        ssize_t amount = io61_read(inf, buf, block_size);
-        if (amount <= 0)
-            break;
-        io61_seek(outf, pos);
-        io61_write(outf, buf, amount);
+        // Transfer those blocks
+        io61_read_batch(inf, reqs, nreqs);
+        for (size_t i = 0; i != nreqs && !done; ++i) {
+            if (reqs[i].result <= 0)
+                done = 1;
+            else {
+                io61_seek(outf, reqs[i].off);
+                io61_write(outf, reqs[i].dst, reqs[i].result);
+            }
+        }
     }
 
     io61_close(inf);
@@ -13,9 +13,26 @@
 
 struct io61_file {
     int fd;
+    int checksumming;
+    uint32_t crc;
+    int threadsafe;
+    int fdflags;    // F_GETFL flags to restore on close, or -1
 };
 
 
+// crc32c_update(crc, buf, sz)
+//    Extend the running CRC32C value `crc` over `buf[0..sz)`.
+
+static uint32_t crc32c_update(uint32_t crc, const char* buf, size_t sz) {
+    for (size_t i = 0; i != sz; ++i) {
+        crc ^= (unsigned char) buf[i];
+        for (int k = 0; k != 8; ++k)
+            crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+    }
+    return crc;
+}
+
+
 // io61_fdopen(fd, mode)
 //    Return a new io61_file for file descriptor `fd`. `mode` is
 //    either O_RDONLY for a read-only file or O_WRONLY for a
@@ -25,6 +42,9 @@ io61_file* io61_fdopen(int fd, int mode) {
     assert(fd >= 0);
     io61_file* f = (io61_file*) malloc(sizeof(io61_file));
     f->fd = fd;
+    f->checksumming = 0;
+    f->threadsafe = 0;
+    f->fdflags = -1;
     (void) mode;
     return f;
 }
@@ -34,6 +54,8 @@ io61_file* io61_fdopen(int fd, int mode) {
 //    Close the io61_file `f` and release all its resources.
 
 int io61_close(io61_file* f) {
+    if (f->fdflags >= 0)
+        fcntl(f->fd, F_SETFL, f->fdflags);
     io61_flush(f);
     int r = close(f->fd);
     free(f);
@@ -47,8 +69,11 @@ int io61_close(io61_file* f) {
 
 int io61_readc(io61_file* f) {
     unsigned char buf[1];
-    if (read(f->fd, buf, 1) == 1)
+    if (read(f->fd, buf, 1) == 1) {
+        if (f->checksumming)
+            f->crc = crc32c_update(f->crc, (char*) buf, 1);
         return buf[0];
+    }
     else
         return EOF;
 }
@@ -77,6 +102,85 @@ ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
 }
 
 
+// io61_read_until(f, delim, buf, sz)
+//    Read characters from `f` into `buf` up to and including the first
+//    occurrence of `delim`, reading at most `sz` characters. Returns the
+//    number of characters read, or -1 if an error occurred before any
+//    characters were read.
+
+ssize_t io61_read_until(io61_file* f, int delim, char* buf, size_t sz) {
+    size_t nread = 0;
+    while (nread != sz) {
+        int ch = io61_readc(f);
+        if (ch == EOF)
+            break;
+        buf[nread] = ch;
+        ++nread;
+        if (ch == (unsigned char) delim)
+            break;
+    }
+    if (nread != 0 || sz == 0 || io61_eof(f))
+        return nread;
+    else
+        return -1;
+}
+
+
+// io61_readline(f, buf, sz)
+//    Read one newline-terminated line from `f` into `buf`.
+
+ssize_t io61_readline(io61_file* f, char* buf, size_t sz) {
+    return io61_read_until(f, '\n', buf, sz);
+}
+
+
+// io61_records_open(f, record_size)
+//    Return an iterator over the `record_size`-byte records of `f`.
+//    Returns NULL if `record_size` is 0.
+
+struct io61_records {
+    io61_file* f;
+    size_t size;
+    char* stage;
+};
+
+io61_records* io61_records_open(io61_file* f, size_t record_size) {
+    if (record_size == 0)
+        return NULL;
+    io61_records* r = (io61_records*) malloc(sizeof(io61_records));
+    if (!r)
+        return NULL;
+    r->f = f;
+    r->size = record_size;
+    r->stage = (char*) malloc(record_size);
+    if (!r->stage) {
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+
+// io61_records_next(r, recp)
+//    Read the next record of `r` and set `*recp` to point at it. Returns
+//    its length, which is short for a final partial record, 0 at end of
+//    file, or -1 on error.
+
+ssize_t io61_records_next(io61_records* r, const char** recp) {
+    *recp = r->stage;
+    return io61_read(r->f, r->stage, r->size);
+}
+
+
+// io61_records_close(r)
+//    Free the record iterator `r`.
+
+void io61_records_close(io61_records* r) {
+    free(r->stage);
+    free(r);
+}
+
+
 // io61_writec(f)
 //    Write a single character `ch` to `f`. Returns 0 on success or
 //    -1 on error.
@@ -84,8 +188,11 @@ ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
 int io61_writec(io61_file* f, int ch) {
     unsigned char buf[1];
     buf[0] = ch;
-    if (write(f->fd, buf, 1) == 1)
+    if (write(f->fd, buf, 1) == 1) {
+        if (f->checksumming)
+            f->crc = crc32c_update(f->crc, (char*) buf, 1);
         return 0;
+    }
     else
         return -1;
 }
@@ -97,6 +204,9 @@ int io61_writec(io61_file* f, int ch) {
 //    an error occurred before any characters were written.
 
 ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
+    if (f->threadsafe)
+        // One system call per write keeps concurrent writes contiguous
+        return write(f->fd, buf, sz);
     size_t nwritten = 0;
     while (nwritten != sz) {
         if (io61_writec(f, buf[nwritten]) == -1)
@@ -121,6 +231,149 @@ int io61_flush(io61_file* f) {
 }
 
 
+// io61_set_checksum(f)
+//    Start computing a CRC32C checksum of the data passing through `f`.
+
+int io61_set_checksum(io61_file* f) {
+    f->checksumming = 1;
+    f->crc = 0xFFFFFFFF;
+    return 0;
+}
+
+
+// io61_checksum(f)
+//    Return the CRC32C of the data that has passed through `f`.
+
+uint32_t io61_checksum(io61_file* f) {
+    return ~f->crc;
+}
+
+
+// io61_set_compressed(f)
+//    Put `f` in compressed mode. This version does not support it.
+
+int io61_set_compressed(io61_file* f) {
+    (void) f;
+    return -1;
+}
+
+
+// io61_set_nonblocking(f)
+//    Set O_NONBLOCK on `f`'s file descriptor. This version has no buffer,
+//    so reads and writes simply stop when the descriptor would block.
+//    `io61_close` restores the original flags.
+
+int io61_set_nonblocking(io61_file* f) {
+    int flags = fcntl(f->fd, F_GETFL);
+    if (flags < 0 || fcntl(f->fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return -1;
+    if (f->fdflags < 0)
+        f->fdflags = flags;
+    return 0;
+}
+
+
+// io61_pollfd(f)
+//    Return the file descriptor an event loop should poll for `f`.
+
+int io61_pollfd(io61_file* f) {
+    return f->fd;
+}
+
+
+// io61_wants_write(f)
+//    Return 1 if `f` has buffered output. This version never does.
+
+int io61_wants_write(io61_file* f) {
+    (void) f;
+    return 0;
+}
+
+
+// io61_set_prefetch(f)
+//    Put `f` in prefetch mode. This version does not support it.
+
+int io61_set_prefetch(io61_file* f) {
+    (void) f;
+    return -1;
+}
+
+
+// io61_copy(inf, outf, flags)
+//    Copy the rest of `inf` to `outf`. This version ignores `flags` and
+//    copies a character at a time.
+
+ssize_t io61_copy(io61_file* inf, io61_file* outf, int flags) {
+    (void) flags;
+    size_t ncopied = 0;
+    int ch;
+    while ((ch = io61_readc(inf)) != EOF) {
+        if (io61_writec(outf, ch) == -1)
+            break;
+        ++ncopied;
+    }
+    return ncopied;
+}
+
+
+// io61_tee(inf, outfs, noutfs)
+//    Copy the rest of `inf` to each of the `noutfs` files in `outfs`, a
+//    character at a time.
+
+ssize_t io61_tee(io61_file* inf, io61_file** outfs, int noutfs) {
+    size_t ncopied = 0;
+    int ch;
+    while ((ch = io61_readc(inf)) != EOF) {
+        for (int i = 0; i != noutfs; ++i)
+            if (io61_writec(outfs[i], ch) == -1)
+                return ncopied;
+        ++ncopied;
+    }
+    return ncopied;
+}
+
+
+// io61_setvbuf(f, size, flags)
+//    Change the buffer size of `f`. This version has no buffer.
+
+int io61_setvbuf(io61_file* f, size_t size, int flags) {
+    (void) f, (void) size, (void) flags;
+    return 0;
+}
+
+
+// io61_set_writebehind(f, nbuffers)
+//    Put `f` in write-behind mode. Not supported by this version.
+
+int io61_set_writebehind(io61_file* f, int nbuffers) {
+    (void) f, (void) nbuffers;
+    return -1;
+}
+
+
+// io61_set_threadsafe(f)
+//    Allow several threads to write to `f`. This version has no buffer,
+//    but writes a character at a time, so in this mode each `io61_write`
+//    becomes a single system call instead. Not available for checksummed
+//    files.
+
+int io61_set_threadsafe(io61_file* f) {
+    if (f->checksumming)
+        return -1;
+    f->threadsafe = 1;
+    return 0;
+}
+
+
+// io61_map_output(f, size)
+//    Switch `f` to mapped output. Not supported by this version.
+
+int io61_map_output(io61_file* f, off_t size) {
+    (void) f, (void) size;
+    return -1;
+}
+
+
 // io61_seek(f, pos)
 //    Change the file pointer for file `f` to `pos` bytes into the file.
 //    Returns 0 on success and -1 on failure.
@@ -134,6 +387,59 @@ int io61_seek(io61_file* f, off_t pos) {
 }
 
 
+// io61_tell(f)
+//    Return the current file position of `f`.
+
+off_t io61_tell(io61_file* f) {
+    return lseek(f->fd, 0, SEEK_CUR);
+}
+
+
+// io61_fstream(f)
+//    Return a stdio stream for `f`'s file descriptor and release `f`.
+
+FILE* io61_fstream(io61_file* f) {
+    int flags = fcntl(f->fd, F_GETFL);
+    FILE* stream = fdopen(f->fd, (flags & O_ACCMODE) == O_RDONLY ? "r" : "w");
+    if (stream)
+        free(f);
+    return stream;
+}
+
+
+// io61_fopen(filename, mode)
+//    Open `filename` as a stdio stream. This version just calls `fopen`.
+
+FILE* io61_fopen(const char* filename, const char* mode) {
+    return fopen(filename, mode);
+}
+
+
+// io61_read_batch(f, reqs, n)
+//    Read each of the `n` requests in `reqs` from `f`, setting
+//    `reqs[i].result` to the number of characters read or -1. Returns the
+//    total number of characters read, or -1 if an error occurred before
+//    any characters were read.
+
+ssize_t io61_read_batch(io61_file* f, io61_readreq* reqs, size_t n) {
+    ssize_t total = 0;
+    int error = 0;
+    for (size_t i = 0; i != n; ++i) {
+        if (io61_seek(f, reqs[i].off) < 0) {
+            reqs[i].result = -1;
+            error = 1;
+            continue;
+        }
+        reqs[i].result = io61_read(f, reqs[i].dst, reqs[i].len);
+        if (reqs[i].result >= 0)
+            total += reqs[i].result;
+        else
+            error = 1;
+    }
+    return total || !error ? total : -1;
+}
+
+
 // You shouldn't need to change these functions.
 
 // io61_open_check(filename, mode)
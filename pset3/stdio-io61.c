@@ -10,13 +10,25 @@
 
 struct io61_file {
     FILE* f;
+    int checksumming;
+    uint32_t crc;
 };
 
+static uint32_t crc32c_update(uint32_t crc, const char* buf, size_t sz) {
+    for (size_t i = 0; i != sz; ++i) {
+        crc ^= (unsigned char) buf[i];
+        for (int k = 0; k != 8; ++k)
+            crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+    }
+    return crc;
+}
+
 
 io61_file* io61_fdopen(int fd, int mode) {
     assert(fd >= 0);
     io61_file* f = (io61_file*) malloc(sizeof(io61_file));
     f->f = fdopen(fd, mode == O_RDONLY ? "r" : "w");
+    f->checksumming = 0;
     return f;
 }
 
@@ -29,24 +41,91 @@ int io61_close(io61_file* f) {
 
 
 int io61_readc(io61_file* f) {
-    return fgetc(f->f);
+    int ch = fgetc(f->f);
+    if (f->checksumming && ch != EOF) {
+        char c = ch;
+        f->crc = crc32c_update(f->crc, &c, 1);
+    }
+    return ch;
 }
 
 ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
     size_t n = fread(buf, 1, sz, f->f);
+    if (f->checksumming)
+        f->crc = crc32c_update(f->crc, buf, n);
     if (n != 0 || sz == 0 || !ferror(f->f))
         return (ssize_t) n;
     else
         return (ssize_t) -1;
 }
 
+ssize_t io61_read_until(io61_file* f, int delim, char* buf, size_t sz) {
+    size_t n = 0;
+    int ch;
+    while (n != sz && (ch = fgetc(f->f)) != EOF) {
+        buf[n] = ch;
+        ++n;
+        if (f->checksumming)
+            f->crc = crc32c_update(f->crc, &buf[n - 1], 1);
+        if (ch == (unsigned char) delim)
+            break;
+    }
+    if (n != 0 || sz == 0 || !ferror(f->f))
+        return (ssize_t) n;
+    else
+        return (ssize_t) -1;
+}
+
+ssize_t io61_readline(io61_file* f, char* buf, size_t sz) {
+    return io61_read_until(f, '\n', buf, sz);
+}
+
+
+struct io61_records {
+    io61_file* f;
+    size_t size;
+    char* stage;
+};
+
+io61_records* io61_records_open(io61_file* f, size_t record_size) {
+    if (record_size == 0)
+        return NULL;
+    io61_records* r = (io61_records*) malloc(sizeof(io61_records));
+    if (!r)
+        return NULL;
+    r->f = f;
+    r->size = record_size;
+    r->stage = (char*) malloc(record_size);
+    if (!r->stage) {
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+ssize_t io61_records_next(io61_records* r, const char** recp) {
+    *recp = r->stage;
+    return io61_read(r->f, r->stage, r->size);
+}
+
+void io61_records_close(io61_records* r) {
+    free(r->stage);
+    free(r);
+}
+
 
 int io61_writec(io61_file* f, int ch) {
+    if (f->checksumming) {
+        char c = ch;
+        f->crc = crc32c_update(f->crc, &c, 1);
+    }
     return fputc(ch, f->f);
 }
 
 ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
     size_t n = fwrite(buf, 1, sz, f->f);
+    if (f->checksumming)
+        f->crc = crc32c_update(f->crc, buf, n);
     if (n != 0 || sz == 0 || !ferror(f->f))
         return (ssize_t) n;
     else
@@ -58,10 +137,132 @@ int io61_flush(io61_file* f) {
     return fflush(f->f);
 }
 
+int io61_set_checksum(io61_file* f) {
+    f->checksumming = 1;
+    f->crc = 0xFFFFFFFF;
+    return 0;
+}
+
+uint32_t io61_checksum(io61_file* f) {
+    return ~f->crc;
+}
+
+int io61_set_compressed(io61_file* f) {
+    (void) f;
+    return -1;
+}
+
+int io61_set_nonblocking(io61_file* f) {
+    (void) f;
+    return -1;
+}
+
+int io61_pollfd(io61_file* f) {
+    return fileno(f->f);
+}
+
+int io61_wants_write(io61_file* f) {
+    (void) f;
+    return 0;
+}
+
+int io61_set_prefetch(io61_file* f) {
+    (void) f;
+    return -1;
+}
+
+ssize_t io61_copy(io61_file* inf, io61_file* outf, int flags) {
+    (void) flags;
+    char buf[BUFSIZ];
+    size_t ncopied = 0, n;
+    while ((n = fread(buf, 1, sizeof(buf), inf->f)) != 0) {
+        if (inf->checksumming)
+            inf->crc = crc32c_update(inf->crc, buf, n);
+        if (outf->checksumming)
+            outf->crc = crc32c_update(outf->crc, buf, n);
+        if (fwrite(buf, 1, n, outf->f) != n)
+            break;
+        ncopied += n;
+    }
+    if (ncopied != 0 || (!ferror(inf->f) && !ferror(outf->f)))
+        return ncopied;
+    else
+        return -1;
+}
+
+ssize_t io61_tee(io61_file* inf, io61_file** outfs, int noutfs) {
+    char buf[BUFSIZ];
+    size_t ncopied = 0, n;
+    while ((n = fread(buf, 1, sizeof(buf), inf->f)) != 0) {
+        if (inf->checksumming)
+            inf->crc = crc32c_update(inf->crc, buf, n);
+        for (int i = 0; i != noutfs; ++i)
+            if (io61_write(outfs[i], buf, n) != (ssize_t) n)
+                return ncopied ? (ssize_t) ncopied : -1;
+        ncopied += n;
+    }
+    if (ncopied != 0 || !ferror(inf->f))
+        return ncopied;
+    else
+        return -1;
+}
+
+int io61_setvbuf(io61_file* f, size_t size, int flags) {
+    (void) flags;
+    return setvbuf(f->f, NULL, _IOFBF, size);
+}
+
+int io61_set_writebehind(io61_file* f, int nbuffers) {
+    (void) f, (void) nbuffers;
+    return -1;
+}
+
+int io61_set_threadsafe(io61_file* f) {
+    (void) f;                   // stdio streams lock internally
+    return 0;
+}
+
+int io61_map_output(io61_file* f, off_t size) {
+    (void) f, (void) size;
+    return -1;
+}
+
 int io61_seek(io61_file* f, off_t pos) {
     return fseek(f->f, pos, SEEK_SET);
 }
 
+off_t io61_tell(io61_file* f) {
+    return ftello(f->f);
+}
+
+FILE* io61_fstream(io61_file* f) {
+    FILE* stream = f->f;
+    free(f);
+    return stream;
+}
+
+FILE* io61_fopen(const char* filename, const char* mode) {
+    return fopen(filename, mode);
+}
+
+ssize_t io61_read_batch(io61_file* f, io61_readreq* reqs, size_t n) {
+    ssize_t total = 0;
+    int error = 0;
+    for (size_t i = 0; i != n; ++i) {
+        if (fseek(f->f, reqs[i].off, SEEK_SET) != 0) {
+            reqs[i].result = -1;
+            error = 1;
+            continue;
+        }
+        reqs[i].result = io61_read(f, reqs[i].dst, reqs[i].len);
+        if (reqs[i].result >= 0)
+            total += reqs[i].result;
+        else
+            error = 1;
+    }
+    return total || !error ? total : -1;
+}
+
 
 io61_file* io61_open_check(const char* filename, int mode) {
     int fd;
@@ -0,0 +1,30 @@
+#include "io61.h"
+
+// Usage: ./tee61 [FILE1 FILE2...]
+//    Copies the standard input to every FILE with `io61_tee`. (With one
+//    FILE, this is `io61_copy`.) If the standard input is a pipe, the
+//    data is moved by the kernel and never enters this process.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args = io61_parse_arguments(argc, argv, "#");
+    // Note that we use `args.input_files` for OUTPUT files.
+
+    // Open files
+    int nfiles = args.n_input_files;
+    io61_profile_begin();
+    io61_file* inf = io61_fdopen(STDIN_FILENO, O_RDONLY);
+    io61_file** outfs = (io61_file**) calloc(nfiles, sizeof(io61_file*));
+    for (int i = 0; i < nfiles; ++i)
+        outfs[i] = io61_open_check(args.input_files[i],
+                                   O_WRONLY | O_CREAT | O_TRUNC);
+
+    // Copy file data
+    io61_tee(inf, outfs, nfiles);
+
+    io61_close(inf);
+    for (int i = 0; i < nfiles; ++i)
+        io61_close(outfs[i]);
+    io61_profile_end();
+    free(outfs);
+}
@@ -0,0 +1,104 @@
+#include "io61.h"
+#include <pthread.h>
+
+// Usage: ./threadlog61 [-o OUTFILE]
+//    Has NTHREADS threads append NRECORDS variable-length records each to
+//    one thread-safe log file, then reads the log back and checks that
+//    every record appears exactly once and intact. Writes the records to
+//    OUTFILE in thread and record order, with a note for every record
+//    that was missing, duplicated, or interleaved with another.
+
+#define NTHREADS 8
+#define NRECORDS 20000
+
+static io61_file* logfile;
+
+// make_record(t, r, buf)
+//    Write record `r` of thread `t` into `buf` and return its length.
+//    Lengths vary from 11 to 71 bytes so that records straddle buffer
+//    boundaries at every alignment.
+
+static size_t make_record(int t, int r, char* buf) {
+    size_t n = sprintf(buf, "%02d %06d ", t, r);
+    size_t npayload = (r * 7 + t) % 61 + 1;
+    memset(&buf[n], 'a' + t, npayload);
+    buf[n + npayload] = '\n';
+    return n + npayload + 1;
+}
+
+static void* writer(void* arg) {
+    int t = (int) (intptr_t) arg;
+    char buf[128];
+    for (int r = 0; r != NRECORDS; ++r)
+        io61_write(logfile, buf, make_record(t, r, buf));
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args = io61_parse_arguments(argc, argv, "o:");
+
+    // Open the log as an unlinked temporary file
+    char logname[] = "/tmp/threadlog61.XXXXXX";
+    int fd = mkstemp(logname);
+    if (fd < 0) {
+        perror("mkstemp");
+        exit(1);
+    }
+    unlink(logname);
+    int readfd = dup(fd);
+
+    io61_profile_begin();
+    logfile = io61_fdopen(fd, O_WRONLY);
+    io61_set_threadsafe(logfile);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+
+    // Write the log from all threads at once
+    pthread_t threads[NTHREADS];
+    for (int t = 0; t != NTHREADS; ++t)
+        pthread_create(&threads[t], NULL, writer, (void*) (intptr_t) t);
+    for (int t = 0; t != NTHREADS; ++t)
+        pthread_join(threads[t], NULL);
+    io61_close(logfile);
+
+    // Read it back, counting each intact record
+    unsigned char* seen = (unsigned char*) calloc(NTHREADS, NRECORDS);
+    int nbad = 0;
+    lseek(readfd, 0, SEEK_SET);
+    io61_file* inf = io61_fdopen(readfd, O_RDONLY);
+    char line[256], expected[128];
+    ssize_t n;
+    while ((n = io61_readline(inf, line, sizeof(line))) > 0) {
+        int t, r;
+        if (sscanf(line, "%d %d ", &t, &r) == 2
+            && t >= 0 && t < NTHREADS && r >= 0 && r < NRECORDS
+            && (size_t) n == make_record(t, r, expected)
+            && memcmp(line, expected, n) == 0) {
+            if (seen[t * NRECORDS + r] != 255)
+                ++seen[t * NRECORDS + r];
+        } else
+            ++nbad;
+    }
+    io61_close(inf);
+
+    // Write the records in order, noting any that went wrong
+    for (int t = 0; t != NTHREADS; ++t)
+        for (int r = 0; r != NRECORDS; ++r) {
+            int count = seen[t * NRECORDS + r];
+            size_t m = make_record(t, r, expected);
+            if (count != 1)
+                m = sprintf(expected, "%02d %06d written %d times\n",
+                            t, r, count);
+            io61_write(outf, expected, m);
+        }
+    if (nbad != 0) {
+        size_t m = sprintf(expected, "%d malformed records\n", nbad);
+        io61_write(outf, expected, m);
+        fprintf(stderr, "threadlog61: %d malformed records\n", nbad);
+    }
+
+    io61_close(outf);
+    io61_profile_end();
+    free(seen);
+}
@@ -0,0 +1,318 @@
+#include "io61.h"
+#include <pthread.h>
+#include <math.h>
+#include <time.h>
+
+// Usage: ./workload61 [-m MIX] [-s SIZE] [-b BLOCKSIZE] [-r RANDOMSEED]
+//                     FILE
+//    Runs a synthetic mix of reads and writes against FILE and reports
+//    throughput and per-operation latency percentiles. FILE is created
+//    or extended to SIZE bytes (default 16MB) first. MIX is a
+//    comma-separated list of settings:
+//        read=PCT        percentage of operations that read (default 50)
+//        size=N[-M]      bytes per operation, fixed or uniform in [N, M]
+//                        (default 4096)
+//        offsets=uniform|zipf[:THETA]
+//                        how random offsets are chosen (default
+//                        uniform; zipf THETA defaults to 0.99)
+//        run=N           operations per sequential run: each run starts
+//                        at a random offset and continues where the
+//                        previous operation ended (default 1)
+//        threads=N       threads, each with its own io61 handles
+//                        (default 1)
+//        ops=N           operations per thread (default 10000)
+//    Random offsets are multiples of BLOCKSIZE (default 4096).
+
+typedef struct workload {
+    int read_pct;
+    size_t min_size;
+    size_t max_size;
+    int zipf;
+    double theta;
+    int run;
+    int nthreads;
+    size_t nops;
+    const char* filename;
+    size_t file_size;
+    size_t block_size;
+    size_t nblocks;
+    double zeta_n;          // Zipf normalization constants
+    double zipf_alpha;
+    double zipf_eta;
+} workload;
+
+typedef struct worker {
+    const workload* w;
+    pthread_t thread;
+    uint64_t rng;
+    uint64_t* read_ns;      // Latency of each read, in nanoseconds
+    size_t nreads;
+    uint64_t* write_ns;
+    size_t nwrites;
+    size_t nbytes;
+} worker;
+
+
+static void parse_mix(workload* w, const char* mix) {
+    char* copy = strdup(mix);
+    for (char* tok = strtok(copy, ","); tok; tok = strtok(NULL, ",")) {
+        char* eq = strchr(tok, '=');
+        if (!eq)
+            goto bad;
+        *eq = '\0';
+        const char* val = eq + 1;
+        char* end;
+        if (strcmp(tok, "read") == 0) {
+            w->read_pct = strtol(val, &end, 0);
+            if (*end || w->read_pct < 0 || w->read_pct > 100)
+                goto bad;
+        } else if (strcmp(tok, "size") == 0) {
+            w->min_size = w->max_size = strtoul(val, &end, 0);
+            if (*end == '-')
+                w->max_size = strtoul(end + 1, &end, 0);
+            if (*end || w->min_size == 0 || w->max_size < w->min_size)
+                goto bad;
+        } else if (strcmp(tok, "offsets") == 0) {
+            if (strcmp(val, "uniform") == 0)
+                w->zipf = 0;
+            else if (strncmp(val, "zipf", 4) == 0) {
+                w->zipf = 1;
+                if (val[4] == ':') {
+                    w->theta = strtod(val + 5, &end);
+                    if (*end || w->theta <= 0 || w->theta >= 1)
+                        goto bad;
+                } else if (val[4])
+                    goto bad;
+            } else
+                goto bad;
+        } else if (strcmp(tok, "run") == 0) {
+            w->run = strtol(val, &end, 0);
+            if (*end || w->run < 1)
+                goto bad;
+        } else if (strcmp(tok, "threads") == 0) {
+            w->nthreads = strtol(val, &end, 0);
+            if (*end || w->nthreads < 1 || w->nthreads > 1024)
+                goto bad;
+        } else if (strcmp(tok, "ops") == 0) {
+            w->nops = strtoul(val, &end, 0);
+            if (*end || w->nops == 0)
+                goto bad;
+        } else
+            goto bad;
+    }
+    free(copy);
+    return;
+
+ bad:
+    fprintf(stderr, "workload61: bad mix setting \"%s\"\n", mix);
+    exit(1);
+}
+
+
+// xorshift64*: a small, fast per-thread random number generator
+
+static uint64_t rng_next(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static double rng_double(uint64_t* state) {
+    return (rng_next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+// Zipf-distributed block choice, by the method of Gray et al., "Quickly
+// Generating Billion-Record Synthetic Databases" (SIGMOD 1994). Ranks
+// are scrambled with a hash so the hot blocks are spread over the file.
+
+static void zipf_init(workload* w) {
+    double zeta2 = 1 + pow(0.5, w->theta);
+    w->zeta_n = 0;
+    for (size_t i = 1; i <= w->nblocks; ++i)
+        w->zeta_n += pow(1.0 / i, w->theta);
+    w->zipf_alpha = 1 / (1 - w->theta);
+    w->zipf_eta = (1 - pow(2.0 / w->nblocks, 1 - w->theta))
+        / (1 - zeta2 / w->zeta_n);
+}
+
+static size_t zipf_next(const workload* w, uint64_t* rng) {
+    double u = rng_double(rng);
+    double uz = u * w->zeta_n;
+    size_t rank;
+    if (uz < 1)
+        rank = 0;
+    else if (uz < 1 + pow(0.5, w->theta))
+        rank = 1;
+    else
+        rank = w->nblocks * pow(w->zipf_eta * u - w->zipf_eta + 1,
+                                w->zipf_alpha);
+    if (rank >= w->nblocks)
+        rank = w->nblocks - 1;
+    uint64_t h = 14695981039346656037ULL;   // FNV-1a over the rank
+    for (int i = 0; i != 8; ++i)
+        h = (h ^ ((rank >> (8 * i)) & 0xFF)) * 1099511628211ULL;
+    return h % w->nblocks;
+}
+
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void* worker_thread(void* arg) {
+    worker* wk = (worker*) arg;
+    const workload* w = wk->w;
+    io61_file* inf = io61_open_check(w->filename, O_RDONLY);
+    io61_file* outf = io61_open_check(w->filename, O_WRONLY);
+    char* buf = (char*) malloc(w->max_size);
+    memset(buf, 'w', w->max_size);
+
+    size_t off = 0;
+    for (size_t i = 0; i != wk->w->nops; ++i) {
+        size_t sz = w->min_size;
+        if (w->max_size > w->min_size)
+            sz += rng_next(&wk->rng) % (w->max_size - w->min_size + 1);
+        if (sz > w->file_size)
+            sz = w->file_size;
+        if (i % w->run == 0 || off + sz > w->file_size) {
+            size_t block = w->zipf ? zipf_next(w, &wk->rng)
+                : rng_next(&wk->rng) % w->nblocks;
+            off = block * w->block_size;
+            if (off + sz > w->file_size)
+                off = w->file_size - sz;
+        }
+
+        int is_read = (int) (rng_next(&wk->rng) % 100) < w->read_pct;
+        uint64_t start = now_ns();
+        ssize_t n;
+        if (is_read) {
+            n = io61_seek(inf, off) < 0 ? -1 : io61_read(inf, buf, sz);
+            wk->read_ns[wk->nreads++] = now_ns() - start;
+        } else {
+            n = io61_seek(outf, off) < 0 ? -1 : io61_write(outf, buf, sz);
+            wk->write_ns[wk->nwrites++] = now_ns() - start;
+        }
+        if (n < 0) {
+            fprintf(stderr, "workload61: %s at offset %zu failed\n",
+                    is_read ? "read" : "write", off);
+            exit(1);
+        }
+        wk->nbytes += n;
+        off += sz;
+    }
+
+    io61_close(inf);
+    io61_close(outf);
+    free(buf);
+    return NULL;
+}
+
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+static void report_latency(const char* name, uint64_t* ns, size_t n) {
+    if (n == 0)
+        return;
+    qsort(ns, n, sizeof(uint64_t), compare_u64);
+    static const double pcts[] = { 50, 90, 99, 99.9 };
+    printf("%-6s %9zu ops", name, n);
+    for (size_t i = 0; i != sizeof(pcts) / sizeof(pcts[0]); ++i) {
+        size_t idx = (size_t) ceil(pcts[i] / 100 * n) - 1;
+        printf(", p%g %.2fus", pcts[i], ns[idx] / 1000.0);
+    }
+    printf(", max %.2fus\n", ns[n - 1] / 1000.0);
+}
+
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    srandom(83419);
+    io61_arguments args = io61_parse_arguments(argc, argv, "m:s:b:r:");
+    workload w = {
+        50, 4096, 4096, 0, 0.99, 1, 1, 10000,
+        args.input_file, (size_t) 16 << 20, 4096, 0, 0, 0, 0
+    };
+    if (!w.filename) {
+        fprintf(stderr, "workload61: a data FILE is required\n");
+        exit(1);
+    }
+    if (args.mix)
+        parse_mix(&w, args.mix);
+    if ((ssize_t) args.input_size > 0)
+        w.file_size = args.input_size;
+    if (args.block_size)
+        w.block_size = args.block_size;
+    w.nblocks = w.file_size / w.block_size;
+    if (w.nblocks == 0)
+        w.nblocks = 1;
+    if (w.zipf)
+        zipf_init(&w);
+
+    // Make sure the data file is at least `file_size` bytes long
+    io61_file* f = io61_open_check(w.filename, O_WRONLY | O_CREAT);
+    if (io61_filesize(f) < (off_t) w.file_size) {
+        char block[4096];
+        for (size_t i = 0; i != sizeof(block); ++i)
+            block[i] = 'a' + random() % 26;
+        io61_seek(f, 0);
+        for (size_t pos = 0; pos < w.file_size; pos += sizeof(block))
+            io61_write(f, block, w.file_size - pos < sizeof(block)
+                       ? w.file_size - pos : sizeof(block));
+    }
+    io61_close(f);
+
+    worker* workers = (worker*) calloc(w.nthreads, sizeof(worker));
+    for (int i = 0; i != w.nthreads; ++i) {
+        workers[i].w = &w;
+        workers[i].rng = ((uint64_t) random() << 32) | random() | 1;
+        workers[i].read_ns = (uint64_t*) malloc(w.nops * sizeof(uint64_t));
+        workers[i].write_ns = (uint64_t*) malloc(w.nops * sizeof(uint64_t));
+    }
+
+    io61_profile_begin();
+    uint64_t start = now_ns();
+    for (int i = 0; i != w.nthreads; ++i)
+        pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]);
+    for (int i = 0; i != w.nthreads; ++i)
+        pthread_join(workers[i].thread, NULL);
+    double elapsed = (now_ns() - start) / 1e9;
+    io61_profile_end();
+
+    // Merge per-thread latencies and report
+    size_t nreads = 0, nwrites = 0, nbytes = 0;
+    for (int i = 0; i != w.nthreads; ++i) {
+        nreads += workers[i].nreads;
+        nwrites += workers[i].nwrites;
+        nbytes += workers[i].nbytes;
+    }
+    uint64_t* read_ns = (uint64_t*) malloc((nreads + 1) * sizeof(uint64_t));
+    uint64_t* write_ns = (uint64_t*) malloc((nwrites + 1) * sizeof(uint64_t));
+    for (int i = 0, r = 0, wr = 0; i != w.nthreads; ++i) {
+        memcpy(&read_ns[r], workers[i].read_ns,
+               workers[i].nreads * sizeof(uint64_t));
+        r += workers[i].nreads;
+        memcpy(&write_ns[wr], workers[i].write_ns,
+               workers[i].nwrites * sizeof(uint64_t));
+        wr += workers[i].nwrites;
+        free(workers[i].read_ns);
+        free(workers[i].write_ns);
+    }
+
+    printf("workload61: %d thread%s, %zu ops in %.3fs: %.0f ops/s, %.1f MiB/s\n",
+           w.nthreads, w.nthreads == 1 ? "" : "s", nreads + nwrites,
+           elapsed, (nreads + nwrites) / elapsed,
+           nbytes / elapsed / (1 << 20));
+    report_latency("read", read_ns, nreads);
+    report_latency("write", write_ns, nwrites);
+
+    free(read_ns);
+    free(write_ns);
+    free(workers);
+}
@@ -0,0 +1,70 @@
+#include "io61.h"
+
+// Usage: ./zseek61 [-b BLOCKSIZE] [-r RANDOMSEED] [-o OUTFILE] [FILE]
+//    Copies the input FILE in blocks into a compressed temporary file,
+//    then reads the temporary file back, writing its contents to OUTFILE,
+//    then seeks it to 1000 random offsets and appends the BLOCKSIZE bytes
+//    found at each to OUTFILE. Default BLOCKSIZE is 4096.
+
+#define NSEEKS 1000
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args = io61_parse_arguments(argc, argv, "b:r:o:");
+    size_t block_size = args.block_size ? args.block_size : 4096;
+
+    // Open the temporary file twice, once to write and once to read
+    char zname[] = "/tmp/zseek61.XXXXXX";
+    int fd = mkstemp(zname);
+    if (fd < 0) {
+        perror("mkstemp");
+        exit(1);
+    }
+    unlink(zname);
+    int readfd = dup(fd);
+
+    // Allocate buffer, open files
+    char* buf = (char*) malloc(block_size);
+
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+
+    // Compress the input
+    io61_file* zf = io61_fdopen(fd, O_WRONLY);
+    io61_set_compressed(zf);
+    while (1) {
+        ssize_t amount = io61_read(inf, buf, block_size);
+        if (amount <= 0)
+            break;
+        io61_write(zf, buf, amount);
+    }
+    io61_close(zf);
+    io61_close(inf);
+
+    // Decompress it sequentially
+    lseek(readfd, 0, SEEK_SET);
+    zf = io61_fdopen(readfd, O_RDONLY);
+    io61_set_compressed(zf);
+    while (1) {
+        ssize_t amount = io61_read(zf, buf, block_size);
+        if (amount <= 0)
+            break;
+        io61_write(outf, buf, amount);
+    }
+
+    // Then at random offsets
+    off_t size = io61_filesize(zf);
+    for (int i = 0; i != NSEEKS && size > 0; ++i) {
+        io61_seek(zf, random() % size);
+        ssize_t amount = io61_read(zf, buf, block_size);
+        if (amount > 0)
+            io61_write(outf, buf, amount);
+    }
+
+    io61_close(zf);
+    io61_close(outf);
+    io61_profile_end();
+    free(buf);
+}
@@ -390,6 +390,119 @@ vamapping virtual_memory_lookup(x86_64_pagetable* pagetable, uintptr_t va) {
 }
 
 
+// pagetable_clone(dst, src, start, end, allocator, clone_entry)
+//    Copy the mappings of `src` for virtual addresses in `[start, end)`
+//    into `dst` (see kernel.h). Each level's loop covers a whole page
+//    table page, so cost scales with the number of present entries.
+
+// level_span(level)
+//    Return the number of bytes of virtual memory one entry of a
+//    level-`level` page table maps.
+static inline uintptr_t level_span(int level) {
+    return (uintptr_t) 1 << (PAGEOFFBITS + (3 - level) * PAGEINDEXBITS);
+}
+
+static int pagetable_clone_level(x86_64_pagetable* dst,
+        x86_64_pagetable* src, int level, uintptr_t base,
+        uintptr_t start, uintptr_t end,
+        x86_64_pagetable* (*allocator)(void),
+        x86_64_pageentry_t (*clone_entry)(uintptr_t, x86_64_pageentry_t*)) {
+    uintptr_t span = level_span(level);
+    for (int index = 0; index < NPAGETABLEENTRIES; ++index) {
+        uintptr_t va = base + index * span;
+        x86_64_pageentry_t pe = src->entry[index];
+        if (!(pe & PTE_P) || va + span <= start || va >= end)
+            continue;
+        if (level == 3) {
+            dst->entry[index] = clone_entry ? clone_entry(va, &src->entry[index])
+                : pe;
+            continue;
+        }
+        if (!(dst->entry[index] & PTE_P)) {
+            x86_64_pagetable* new_pt = allocator ? allocator() : NULL;
+            if (!new_pt)
+                return -1;
+            assert((uintptr_t) new_pt % PAGESIZE == 0);
+            memset(new_pt, 0, PAGESIZE);
+            dst->entry[index] = PTE_ADDR(new_pt) | PTE_P | PTE_W | PTE_U;
+        }
+        if (pagetable_clone_level(
+                (x86_64_pagetable*) PTE_ADDR(dst->entry[index]),
+                (x86_64_pagetable*) PTE_ADDR(pe), level + 1, va,
+                start, end, allocator, clone_entry) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+int pagetable_clone(x86_64_pagetable* dst, x86_64_pagetable* src,
+                    uintptr_t start, uintptr_t end,
+                    x86_64_pagetable* (*allocator)(void),
+                    x86_64_pageentry_t (*clone_entry)(uintptr_t va,
+                                                      x86_64_pageentry_t* pe)) {
+    assert(start % PAGESIZE == 0 && end % PAGESIZE == 0 && start <= end);
+    return pagetable_clone_level(dst, src, 0, 0, start, end,
+                                 allocator, clone_entry);
+}
+
+
+// pagetable_walk(pagetable, start, end, fn)
+//    Call `fn(va, &entry)` for each present level-4 entry of `pagetable`
+//    mapping a virtual address in `[start, end)`.
+
+static void pagetable_walk_level(x86_64_pagetable* pt, int level,
+        uintptr_t base, uintptr_t start, uintptr_t end,
+        void (*fn)(uintptr_t, x86_64_pageentry_t*)) {
+    uintptr_t span = level_span(level);
+    for (int index = 0; index < NPAGETABLEENTRIES; ++index) {
+        uintptr_t va = base + index * span;
+        x86_64_pageentry_t pe = pt->entry[index];
+        if (!(pe & PTE_P) || va + span <= start || va >= end)
+            continue;
+        if (level == 3)
+            fn(va, &pt->entry[index]);
+        else
+            pagetable_walk_level((x86_64_pagetable*) PTE_ADDR(pe), level + 1,
+                                 va, start, end, fn);
+    }
+}
+
+void pagetable_walk(x86_64_pagetable* pagetable, uintptr_t start,
+                    uintptr_t end,
+                    void (*fn)(uintptr_t va, x86_64_pageentry_t* pe)) {
+    pagetable_walk_level(pagetable, 0, 0, start, end, fn);
+}
+
+
+// pagetable_free(pagetable, start, end, release)
+//    Release the pages mapped at `[start, end)` and all page table pages
+//    of `pagetable`, which must not be in use.
+
+static void pagetable_free_level(x86_64_pagetable* pt, int level,
+        uintptr_t base, uintptr_t start, uintptr_t end,
+        void (*release)(uintptr_t)) {
+    uintptr_t span = level_span(level);
+    for (int index = 0; index < NPAGETABLEENTRIES; ++index) {
+        uintptr_t va = base + index * span;
+        x86_64_pageentry_t pe = pt->entry[index];
+        if (!(pe & PTE_P))
+            continue;
+        if (level < 3)
+            pagetable_free_level((x86_64_pagetable*) PTE_ADDR(pe), level + 1,
+                                 va, start, end, release);
+        else if (va >= start && va < end)
+            release(PTE_ADDR(pe));
+    }
+    release((uintptr_t) pt);
+}
+
+void pagetable_free(x86_64_pagetable* pagetable, uintptr_t start,
+                    uintptr_t end, void (*release)(uintptr_t pa)) {
+    assert(pagetable != kernel_pagetable);
+    pagetable_free_level(pagetable, 0, 0, start, end, release);
+}
+
+
 // set_pagetable
 //    Change page directory. lcr3() is the hardware instruction;
 //    set_pagetable() additionally checks that important kernel procedures are
@@ -703,14 +816,16 @@ int error_printf(int cpos, int color, const char* format, ...) {
 
 
 // check_keyboard
-//    Check for the user typing a control key. 'a', 'f', and 'e' cause a soft
-//    reboot where the kernel runs the allocator programs, "fork", or
-//    "forkexit", respectively. Control-C or 'q' exit the virtual machine.
+//    Check for the user typing a control key. 'a', 'f', 'e', 'l', and 'n'
+//    cause a soft reboot where the kernel runs the allocator programs,
+//    "fork", "forkexit", the demand-zero allocators, or the niced CPU hogs,
+//    respectively. Control-C or 'q' exit the virtual machine.
 //    Returns key typed or -1 for no key.
 
 int check_keyboard(void) {
     int c = keyboard_readc();
-    if (c == 'a' || c == 'f' || c == 'e') {
+    if (c == 'a' || c == 'f' || c == 'e' || c == 'l'
+        || c == 'n') {
         // Install a temporary page table to carry us through the
         // process of reinitializing memory. This replicates work the
         // bootloader does.
@@ -730,6 +845,10 @@ int check_keyboard(void) {
             argument = "allocator";
         else if (c == 'e')
             argument = "forkexit";
+        else if (c == 'l')
+            argument = "lazy";
+        else if (c == 'n')
+            argument = "nice";
         uintptr_t argument_ptr = (uintptr_t) argument;
         assert(argument_ptr < 0x100000000L);
         multiboot_info[4] = (uint32_t) argument_ptr;
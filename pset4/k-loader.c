@@ -21,6 +21,10 @@ extern uint8_t _binary_obj_p_fork_start[];
 extern uint8_t _binary_obj_p_fork_end[];
 extern uint8_t _binary_obj_p_forkexit_start[];
 extern uint8_t _binary_obj_p_forkexit_end[];
+extern uint8_t _binary_obj_p_lazyalloc_start[];
+extern uint8_t _binary_obj_p_lazyalloc_end[];
+extern uint8_t _binary_obj_p_nice_start[];
+extern uint8_t _binary_obj_p_nice_end[];
 
 struct ramimage {
     void* begin;
@@ -31,7 +35,9 @@ struct ramimage {
     { _binary_obj_p_allocator3_start, _binary_obj_p_allocator3_end },
     { _binary_obj_p_allocator4_start, _binary_obj_p_allocator4_end },
     { _binary_obj_p_fork_start, _binary_obj_p_fork_end },
-    { _binary_obj_p_forkexit_start, _binary_obj_p_forkexit_end }
+    { _binary_obj_p_forkexit_start, _binary_obj_p_forkexit_end },
+    { _binary_obj_p_lazyalloc_start, _binary_obj_p_lazyalloc_end },
+    { _binary_obj_p_nice_start, _binary_obj_p_nice_end }
 };
 
 static int program_load_segment(proc* p, const elf_program* ph,
@@ -41,7 +47,7 @@ static int program_load_segment(proc* p, const elf_program* ph,
 // program_load(p, programnumber)
 //    Load the code corresponding to program `programnumber` into the process
 //    `p` and set `p->p_registers.reg_rip` to its entry point. Calls
-//    `assign_physical_page` to as required. Returns 0 on success and
+//    `kalloc_page` as required. Returns 0 on success and
 //    -1 on failure (e.g. out-of-memory). `allocator` is passed to
 //    `virtual_memory_map`.
 
@@ -72,7 +78,7 @@ int program_load(proc* p, int programnumber,
 //    Load an ELF segment at virtual address `ph->p_va` in process `p`. Copies
 //    `[src, src + ph->p_filesz)` to `dst`, then clears
 //    `[ph->p_va + ph->p_filesz, ph->p_va + ph->p_memsz)` to 0.
-//    Calls `assign_physical_page` to allocate pages and `virtual_memory_map`
+//    Calls `kalloc_page` to allocate pages and `virtual_memory_map`
 //    to map them in `p->p_pagetable`. Returns 0 on success and -1 on failure.
 
 static int program_load_segment(proc* p, const elf_program* ph,
@@ -83,13 +89,17 @@ static int program_load_segment(proc* p, const elf_program* ph,
     va &= ~(PAGESIZE - 1);              // round to page boundary
 
     // allocate memory
-    for (uintptr_t addr = va; addr < end_mem; addr += PAGESIZE)
-        if (assign_physical_page(addr, p->p_pid) < 0
-            || virtual_memory_map(p->p_pagetable, addr, addr, PAGESIZE,
+    for (uintptr_t addr = va; addr < end_mem; addr += PAGESIZE) {
+        uintptr_t pa = kalloc_page(p->p_pid);
+        if (!pa
+            || virtual_memory_map(p->p_pagetable, addr, pa, PAGESIZE,
                                   PTE_P | PTE_W | PTE_U, allocator) < 0) {
+            if (pa)
+                kfree_page(pa);
             console_printf(CPOS(22, 0), 0xC000, "program_load_segment(pid %d): can't assign address %p\n", p->p_pid, addr);
             return -1;
         }
+    }
 
     // ensure new memory mappings are active
     set_pagetable(p->p_pagetable);
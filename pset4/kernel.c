@@ -30,6 +30,8 @@ static unsigned ticks;          // # timer interrupts so far
 
 void schedule(void);
 void run(proc* p) __attribute__((noreturn));
+static void runqueue_insert(proc* p);
+static void runqueue_remove(proc* p);
 
 int8_t global_owner; // global for use in allocator function
 
@@ -49,12 +51,15 @@ int8_t global_owner; // global for use in allocator function
 //    pageinfo[pn].owner is a constant indicating who owns the page.
 //      PO_KERNEL means the kernel, PO_RESERVED means reserved memory (such
 //      as the console), and a number >=0 means that process ID.
+//    pageinfo[pn].order is the order of the free buddy block that starts
+//      at page `pn`, or -1 if no free block starts there.
 //
 //    pageinfo_init() sets up the initial pageinfo[] state.
 
 typedef struct physical_pageinfo {
     int8_t owner;
     int8_t refcount;
+    int8_t order;
 } physical_pageinfo;
 
 static physical_pageinfo pageinfo[PAGENUMBER(MEMSIZE_PHYSICAL)];
@@ -68,6 +73,81 @@ typedef enum pageowner {
 static void pageinfo_init(void);
 
 
+// PHYSICAL PAGE ALLOCATOR
+//
+//    Free physical memory is managed by a binary buddy allocator. A block
+//    of order `k` is 2^k pages starting at a page number that is a
+//    multiple of 2^k; its buddy is the block whose page number differs
+//    only in bit `k`. Each order has a doubly-linked list of free blocks
+//    threaded through the blocks themselves (the kernel maps all physical
+//    memory at identical addresses, so it can write the links directly).
+//    Allocation splits the smallest large-enough block; freeing merges a
+//    block with its buddy for as long as the buddy is free too. Both take
+//    O(MAXORDER) steps. pageinfo_init() builds the initial lists.
+
+#define MAXORDER 9              // largest block: 2^9 pages = 2MB
+
+typedef struct freepage {
+    struct freepage* prev;
+    struct freepage* next;
+} freepage;
+
+static freepage* freelists[MAXORDER + 1];
+static int nfreeblocks[MAXORDER + 1];
+
+static void freelist_push(int pn, int order) {
+    freepage* fp = (freepage*) PAGEADDRESS(pn);
+    fp->prev = NULL;
+    fp->next = freelists[order];
+    if (freelists[order])
+        freelists[order]->prev = fp;
+    freelists[order] = fp;
+    pageinfo[pn].order = order;
+    ++nfreeblocks[order];
+}
+
+static void freelist_remove(int pn) {
+    freepage* fp = (freepage*) PAGEADDRESS(pn);
+    int order = pageinfo[pn].order;
+    if (fp->prev)
+        fp->prev->next = fp->next;
+    else
+        freelists[order] = fp->next;
+    if (fp->next)
+        fp->next->prev = fp->prev;
+    pageinfo[pn].order = -1;
+    --nfreeblocks[order];
+}
+
+// buddy_release(pn, order)
+//    Return the free block of order `order` at page `pn` to the free
+//    lists, merging it with its buddy as far as possible.
+
+static void buddy_release(int pn, int order) {
+    while (order < MAXORDER) {
+        int buddy = pn ^ (1 << order);
+        if (buddy >= NPAGES || pageinfo[buddy].order != order)
+            break;
+        freelist_remove(buddy);
+        pn &= ~(1 << order);
+        ++order;
+    }
+    freelist_push(pn, order);
+}
+
+// buddy_split(pn, order, want)
+//    Split the free block of order `order` at page `pn`, which has been
+//    removed from the free lists, down to an order-`want` block starting
+//    at `pn`. The unused upper halves go back on the free lists.
+
+static void buddy_split(int pn, int order, int want) {
+    while (order > want) {
+        --order;
+        freelist_push(pn + (1 << order), order);
+    }
+}
+
+
 // Memory functions
 
 void check_virtual_memory(void);
@@ -93,54 +173,325 @@ void kernel(const char* command) {
     for (pid_t i = 0; i < NPROC; i++) {
         processes[i].p_pid = i;
         processes[i].p_state = P_FREE;
+        processes[i].p_rqindex = -1;
     }
 
+    //set access permissions on kernelspace (before process page tables
+    //copy the kernel mappings)
+    virtual_memory_map(kernel_pagetable,(uintptr_t) 0, (uintptr_t) 0, PROC_START_ADDR,
+        PTE_P | PTE_W, NULL);
+    virtual_memory_map(kernel_pagetable,(uintptr_t) console, (uintptr_t)console, PAGESIZE,
+        PTE_P | PTE_W | PTE_U, NULL);
+
     if (command && strcmp(command, "fork") == 0)
         process_setup(1, 4);
     else if (command && strcmp(command, "forkexit") == 0)
         process_setup(1, 5);
+    else if (command && strcmp(command, "lazy") == 0)
+        for (pid_t i = 1; i <= 4; ++i)
+            process_setup(i, 6);
+    else if (command && strcmp(command, "nice") == 0)
+        for (pid_t i = 1; i <= 4; ++i)
+            process_setup(i, 7);
     else
         for (pid_t i = 1; i <= 4; ++i)
             process_setup(i, i - 1);
 
-    //set access permissions on kernelspace
-    virtual_memory_map(kernel_pagetable,(uintptr_t) 0, (uintptr_t) 0, PROC_START_ADDR,
-        PTE_P | PTE_W, NULL);
-    virtual_memory_map(kernel_pagetable,(uintptr_t) console, (uintptr_t)console, PAGESIZE,
-        PTE_P | PTE_W | PTE_U, NULL);
-
     // Switch to the first process using run()
     run(&processes[1]);
 }
 
 
+// kalloc_pages(order, owner)
+//    Allocate 2^`order` physically contiguous pages for `owner` and return
+//    the address of the first, or 0 if no free block is large enough.
+//    Each page gets reference count 1. The contents are undefined.
+
+uintptr_t kalloc_pages(int order, int8_t owner) {
+    assert(order >= 0 && order <= MAXORDER);
+    int k = order;
+    while (k <= MAXORDER && !freelists[k])
+        ++k;
+    if (k > MAXORDER)
+        return 0;
+    int pn = PAGENUMBER(freelists[k]);
+    freelist_remove(pn);
+    buddy_split(pn, k, order);
+    for (int i = pn; i != pn + (1 << order); ++i) {
+        assert(pageinfo[i].refcount == 0);
+        pageinfo[i].refcount = 1;
+        pageinfo[i].owner = owner;
+    }
+    return PAGEADDRESS(pn);
+}
+
+// kalloc_page(owner)
+//    Allocate a free physical page for `owner` and return its address, or
+//    0 if physical memory is exhausted. The page's contents are undefined.
+
+uintptr_t kalloc_page(int8_t owner) {
+    return kalloc_pages(0, owner);
+}
+
+
+// kfree_pages(pa, order)
+//    Drop a reference to each of the 2^`order` pages starting at `pa`,
+//    which must be aligned to its size. Pages that are no longer
+//    referenced are freed; if they all are, the whole block is freed at
+//    once.
+
+void kfree_pages(uintptr_t pa, int order) {
+    assert(order >= 0 && order <= MAXORDER);
+    assert(pa % (PAGESIZE << order) == 0 && pa < MEMSIZE_PHYSICAL);
+    int pn = PAGENUMBER(pa), nfreed = 0;
+    for (int i = pn; i != pn + (1 << order); ++i) {
+        assert(pageinfo[i].refcount > 0);
+        if (--pageinfo[i].refcount == 0) {
+            pageinfo[i].owner = PO_FREE;
+            ++nfreed;
+        }
+    }
+    if (nfreed == (1 << order))
+        buddy_release(pn, order);
+    else
+        for (int i = pn; nfreed != 0 && i != pn + (1 << order); ++i)
+            if (pageinfo[i].refcount == 0) {
+                buddy_release(i, 0);
+                --nfreed;
+            }
+}
+
+// kfree_page(pa)
+//    Drop a reference to the physical page at `pa`, freeing it when no
+//    references remain.
+
+void kfree_page(uintptr_t pa) {
+    kfree_pages(pa, 0);
+}
+
+
+// alloc()
+//    Page table allocator for `virtual_memory_map`: returns a new page
+//    owned by `global_owner`, or NULL if memory is exhausted.
+
 x86_64_pagetable* alloc()
 {
-  for (int i = 0; i < NPAGES; i++) {
-    if (pageinfo[i].refcount == 0) {
-      pageinfo[i].refcount++;
-      pageinfo[i].owner = global_owner;
-      return (x86_64_pagetable*) PAGEADDRESS(i);
-    }
-  }
-  return NULL;
+  return (x86_64_pagetable*) kalloc_page(global_owner);
 }
 
 // copy_pagetable(old, owner)
+//    Return a new page table for process `owner` that shares the kernel
+//    mappings of `old` (everything below PROC_START_ADDR). Returns NULL
+//    if memory is exhausted.
+
+static void free_pagetable(x86_64_pagetable* pt);
+
 x86_64_pagetable* copy_pagetable(x86_64_pagetable* old, pid_t owner)
 {
-  log_printf("Copy pagetable\n");
   global_owner = owner;
   x86_64_pagetable* newL1 = alloc();
-  assert(pageinfo[PAGENUMBER(newL1)].owner == owner);
+  if (!newL1)
+    return NULL;
+  memset(newL1, 0, PAGESIZE);
+  if (pagetable_clone(newL1, old, 0, PROC_START_ADDR, alloc, NULL) < 0) {
+    free_pagetable(newL1);
+    return NULL;
+  }
+  return newL1;
+}
+
+
+// free_pagetable(pt)
+//    Drop the references `pt` holds to user pages (those at or above
+//    PROC_START_ADDR), then free `pt` and its lower-level page tables.
+
+static void free_pagetable(x86_64_pagetable* pt) {
+  pagetable_free(pt, PROC_START_ADDR, MEMSIZE_VIRTUAL, kfree_page);
+}
+
 
-  for (uintptr_t VA = 0; VA < MEMSIZE_VIRTUAL; VA += PAGESIZE) {
+// process_fork(parent)
+//    Create a copy of process `parent` and return its process ID, or -1
+//    if there is no free process slot or not enough memory. The copy
+//    shares the parent's user pages instead of copying them: writable
+//    pages become read-only and PTE_COW in both page tables, and are
+//    copied on the first write fault (see `cow_fault`).
 
-    vamapping info = virtual_memory_lookup(old, VA);
-    log_printf("VA: %x\n PA: %x\n", VA,info.pa );
-    virtual_memory_map(newL1, VA, info.pa, PAGESIZE, info.perm, alloc);
+static x86_64_pageentry_t fork_entry(uintptr_t va, x86_64_pageentry_t* pe) {
+  if (va >= PROC_START_ADDR) {
+    if (*pe & PTE_W)
+      *pe = (*pe & ~PTE_W) | PTE_COW;
+    ++pageinfo[PAGENUMBER(*pe)].refcount;
   }
-  return newL1;
+  return *pe;
+}
+
+static pid_t process_fork(proc* parent) {
+  pid_t pid = 1;
+  while (pid < NPROC && processes[pid].p_state != P_FREE)
+    ++pid;
+  if (pid == NPROC)
+    return -1;
+  proc* child = &processes[pid];
+  global_owner = pid;
+  child->p_pagetable = alloc();
+  if (!child->p_pagetable)
+    return -1;
+  memset(child->p_pagetable, 0, PAGESIZE);
+  if (pagetable_clone(child->p_pagetable, parent->p_pagetable,
+                      0, MEMSIZE_VIRTUAL, alloc, fork_entry) < 0) {
+    free_pagetable(child->p_pagetable);
+    return -1;
+  }
+
+  child->p_registers = parent->p_registers;
+  child->p_registers.reg_rax = 0;
+  memcpy(child->p_lazy, parent->p_lazy, sizeof(child->p_lazy));
+  child->p_stack_bottom = parent->p_stack_bottom;
+  child->p_stack_limit = parent->p_stack_limit;
+  child->p_runtime = 0;
+  child->p_vruntime = parent->p_vruntime;
+  child->p_nice = parent->p_nice;
+  child->p_state = P_RUNNABLE;
+  runqueue_insert(child);
+  return pid;
+}
+
+
+// process_exit(p)
+//    Free process `p`'s memory and process slot. Pages that `p` owned but
+//    that are still shared with other processes are handed to one of them.
+
+static void exit_reassign(uintptr_t va, x86_64_pageentry_t* pe) {
+  (void) va;
+  int8_t* owner = &pageinfo[PAGENUMBER(*pe)].owner;
+  if (*owner >= 0 && processes[*owner].p_state == P_FREE)
+    *owner = global_owner;
+}
+
+static void process_exit(proc* p) {
+  free_pagetable(p->p_pagetable);
+  p->p_pagetable = NULL;
+  memset(p->p_lazy, 0, sizeof(p->p_lazy));
+  runqueue_remove(p);
+  p->p_state = P_FREE;
+  for (pid_t pid = 1; pid < NPROC; ++pid)
+    if (processes[pid].p_state != P_FREE) {
+      global_owner = pid;
+      pagetable_walk(processes[pid].p_pagetable, PROC_START_ADDR,
+                     MEMSIZE_VIRTUAL, exit_reassign);
+    }
+}
+
+
+// process_map_lazy(p, addr, sz)
+//    Add `[addr, addr+sz)` to process `p`'s demand-zero regions. Returns 0
+//    on success and -1 if the range is not page-aligned user memory below
+//    the stack's guard page or `p` has no free region slot.
+
+static int process_map_lazy(proc* p, uintptr_t addr, size_t sz) {
+  uintptr_t guard = p->p_stack_limit - PAGESIZE;
+  if (addr % PAGESIZE != 0 || sz % PAGESIZE != 0 || sz == 0
+      || addr < PROC_START_ADDR || addr > guard || sz > guard - addr)
+    return -1;
+  for (int i = 0; i < NLAZYREGIONS; ++i)
+    if (p->p_lazy[i].start == p->p_lazy[i].end) {
+      p->p_lazy[i].start = addr;
+      p->p_lazy[i].end = addr + sz;
+      return 0;
+    }
+  return -1;
+}
+
+
+// lazy_fault(p, addr)
+//    Handle a user fault by process `p` on the unmapped address `addr`.
+//    If `addr` is in one of `p`'s demand-zero regions, map a zeroed page
+//    there and return 0. Returns -1 if it isn't or memory is exhausted.
+
+static int lazy_fault(proc* p, uintptr_t addr) {
+  for (int i = 0; i < NLAZYREGIONS; ++i)
+    if (addr >= p->p_lazy[i].start && addr < p->p_lazy[i].end) {
+      uintptr_t pa = kalloc_page(p->p_pid);
+      if (!pa)
+        return -1;
+      memset((void*) pa, 0, PAGESIZE);
+      global_owner = p->p_pid;
+      if (virtual_memory_map(p->p_pagetable, ROUNDDOWN(addr, PAGESIZE), pa,
+                             PAGESIZE, PTE_P | PTE_W | PTE_U, alloc) < 0) {
+        kfree_page(pa);
+        return -1;
+      }
+      return 0;
+    }
+  return -1;
+}
+
+
+// stack_fault(p, addr)
+//    Handle a user fault by process `p` on the unmapped address `addr`.
+//    If `addr` is below `p`'s stack but not below its limit, and no more
+//    than a page below the page holding `p`'s %rsp (so it is a push or a
+//    new stack frame, not a stray pointer), grow the stack down to cover
+//    it with zeroed pages and return 0. Such a fault on the guard page
+//    under the limit is a stack overflow: print a message, kill `p`, and
+//    return 0. Otherwise (or if memory is exhausted) return -1.
+
+static void process_exit(proc* p);
+
+static int stack_fault(proc* p, uintptr_t addr) {
+  uintptr_t rsp_page = ROUNDDOWN(p->p_registers.reg_rsp, PAGESIZE);
+  if (addr >= p->p_stack_bottom || addr < p->p_stack_limit - PAGESIZE
+      || rsp_page < PAGESIZE || addr < rsp_page - PAGESIZE)
+    return -1;
+  if (addr < p->p_stack_limit) {
+    console_printf(CPOS(24, 0), 0x0C00,
+                   "Process %d stack overflow at %p!\n", p->p_pid, addr);
+    process_exit(p);
+    return 0;
+  }
+  global_owner = p->p_pid;
+  while (p->p_stack_bottom > ROUNDDOWN(addr, PAGESIZE)) {
+    uintptr_t pa = kalloc_page(p->p_pid);
+    if (!pa)
+      return -1;
+    memset((void*) pa, 0, PAGESIZE);
+    if (virtual_memory_map(p->p_pagetable, p->p_stack_bottom - PAGESIZE, pa,
+                           PAGESIZE, PTE_P | PTE_W | PTE_U, alloc) < 0) {
+      kfree_page(pa);
+      return -1;
+    }
+    p->p_stack_bottom -= PAGESIZE;
+  }
+  return 0;
+}
+
+
+// cow_fault(p, addr)
+//    Handle a user write fault by process `p` at `addr`. If the page is
+//    copy-on-write, give `p` a private writable copy (or, if no other
+//    page table refers to it any more, just make it writable again) and
+//    return 0. Returns -1 if the page isn't copy-on-write or memory is
+//    exhausted.
+
+static int cow_fault(proc* p, uintptr_t addr) {
+  uintptr_t va = ROUNDDOWN(addr, PAGESIZE);
+  vamapping info = virtual_memory_lookup(p->p_pagetable, va);
+  if (info.pn < 0 || !(info.perm & PTE_COW))
+    return -1;
+  int perm = (info.perm & (PTE_P | PTE_U)) | PTE_W;
+  uintptr_t pa = PAGEADDRESS(info.pn);
+  if (pageinfo[info.pn].refcount == 1)
+    pageinfo[info.pn].owner = p->p_pid;
+  else {
+    uintptr_t newpa = kalloc_page(p->p_pid);
+    if (!newpa)
+      return -1;
+    memcpy((void*) newpa, (void*) pa, PAGESIZE);
+    kfree_page(pa);
+    pa = newpa;
+  }
+  return virtual_memory_map(p->p_pagetable, va, pa, PAGESIZE, perm, NULL);
 }
 
 
@@ -152,24 +503,33 @@ x86_64_pagetable* copy_pagetable(x86_64_pagetable* old, pid_t owner)
 
 void process_setup(pid_t pid, int program_number) {
     process_init(&processes[pid], 0);
+    memset(processes[pid].p_lazy, 0, sizeof(processes[pid].p_lazy));
     processes[pid].p_pagetable = copy_pagetable(kernel_pagetable, pid);
-    //copy_pagetable(kernel_pagetable, pid);
-    //++pageinfo[PAGENUMBER(kernel_pagetable)].refcount;
-    int r = program_load(&processes[pid], program_number, NULL);
+    assert(processes[pid].p_pagetable);
+    int r = program_load(&processes[pid], program_number, alloc);
     assert(r >= 0);
-    processes[pid].p_registers.reg_rsp = PROC_START_ADDR + PROC_SIZE * pid;
-    uintptr_t stack_page = processes[pid].p_registers.reg_rsp - PAGESIZE;
-    assign_physical_page(stack_page, pid);
-    virtual_memory_map(processes[pid].p_pagetable, stack_page, stack_page,
-                       PAGESIZE, PTE_P | PTE_W | PTE_U, NULL);
+    processes[pid].p_registers.reg_rsp = MEMSIZE_VIRTUAL;
+    uintptr_t stack_page = MEMSIZE_VIRTUAL - PAGESIZE;
+    processes[pid].p_stack_bottom = stack_page;
+    processes[pid].p_stack_limit = MEMSIZE_VIRTUAL - STACK_MAXSIZE;
+    uintptr_t stack_pa = kalloc_page(pid);
+    assert(stack_pa);
+    r = virtual_memory_map(processes[pid].p_pagetable, stack_page, stack_pa,
+                           PAGESIZE, PTE_P | PTE_W | PTE_U, alloc);
+    assert(r >= 0);
+    processes[pid].p_runtime = 0;
+    processes[pid].p_vruntime = 0;
+    processes[pid].p_nice = 0;
     processes[pid].p_state = P_RUNNABLE;
+    runqueue_insert(&processes[pid]);
 }
 
 
 // assign_physical_page(addr, owner)
 //    Allocates the page with physical address `addr` to the given owner.
 //    Fails if physical page `addr` was already allocated. Returns 0 on
-//    success and -1 on failure. Used by the program loader.
+//    success and -1 on failure. Use `kalloc_page` unless a particular
+//    physical page is required.
 
 int assign_physical_page(uintptr_t addr, int8_t owner) {
     if ((addr & 0xFFF) != 0
@@ -177,6 +537,23 @@ int assign_physical_page(uintptr_t addr, int8_t owner) {
         || pageinfo[PAGENUMBER(addr)].refcount != 0)
         return -1;
     else {
+        // find the free block containing `addr` and split it down
+        int pn = PAGENUMBER(addr), order = 0;
+        while (pageinfo[pn & ~((1 << order) - 1)].order != order) {
+            ++order;
+            assert(order <= MAXORDER);
+        }
+        int block = pn & ~((1 << order) - 1);
+        freelist_remove(block);
+        while (order > 0) {
+            --order;
+            int half = block + (1 << order);
+            if (pn >= half) {
+                freelist_push(block, order);
+                block = half;
+            } else
+                freelist_push(half, order);
+        }
         pageinfo[PAGENUMBER(addr)].refcount = 1;
         pageinfo[PAGENUMBER(addr)].owner = owner;
         return 0;
@@ -184,6 +561,110 @@ int assign_physical_page(uintptr_t addr, int8_t owner) {
 }
 
 
+// RUN QUEUE
+//
+//    Runnable processes are kept in a binary min-heap ordered by virtual
+//    runtime, `p_vruntime`, so the next process to run is found in O(1)
+//    and requeued in O(log NPROC). Each timer tick a process runs adds
+//    VRUNTIME_TICK / weight to its virtual runtime, where the weight
+//    comes from its nice value (the same table Linux uses: each nice step
+//    is worth about 25% in weight). Processes that yield or run for less
+//    than a tick are charged less, so CPU-bound processes cannot starve
+//    interactive ones, and CPU time is divided in proportion to weight.
+
+#define VRUNTIME_TICK ((uint64_t) 1024 << 10)   // a tick at weight 1024
+
+static const unsigned nice_weights[NICE_MAX - NICE_MIN + 1] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */ 9548, 7620, 6100, 4904, 3906,
+    /*  -5 */ 3121, 2501, 1991, 1586, 1277,
+    /*   0 */ 1024, 820, 655, 526, 423,
+    /*   5 */ 335, 272, 215, 172, 137,
+    /*  10 */ 110, 87, 70, 56, 45,
+    /*  15 */ 36, 29, 23, 18, 15
+};
+
+static proc* runqueue[NPROC];
+static int nrunqueue;
+
+static int runqueue_less(proc* a, proc* b) {
+    return a->p_vruntime < b->p_vruntime
+        || (a->p_vruntime == b->p_vruntime && a->p_pid < b->p_pid);
+}
+
+static void runqueue_set(int i, proc* p) {
+    runqueue[i] = p;
+    p->p_rqindex = i;
+}
+
+static void runqueue_sift(int i) {
+    proc* p = runqueue[i];
+    while (i > 0 && runqueue_less(p, runqueue[(i - 1) / 2])) {
+        runqueue_set(i, runqueue[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    while (2 * i + 1 < nrunqueue) {
+        int child = 2 * i + 1;
+        if (child + 1 < nrunqueue
+            && runqueue_less(runqueue[child + 1], runqueue[child]))
+            ++child;
+        if (!runqueue_less(runqueue[child], p))
+            break;
+        runqueue_set(i, runqueue[child]);
+        i = child;
+    }
+    runqueue_set(i, p);
+}
+
+// runqueue_insert(p), runqueue_remove(p)
+//    Add runnable process `p` to the run queue, or take it off.
+
+static void runqueue_insert(proc* p) {
+    assert(p->p_rqindex < 0 && nrunqueue < NPROC);
+    runqueue_set(nrunqueue, p);
+    ++nrunqueue;
+    runqueue_sift(nrunqueue - 1);
+}
+
+static void runqueue_remove(proc* p) {
+    int i = p->p_rqindex;
+    if (i < 0)
+        return;
+    p->p_rqindex = -1;
+    --nrunqueue;
+    if (i != nrunqueue) {
+        runqueue_set(i, runqueue[nrunqueue]);
+        runqueue_sift(i);
+    }
+}
+
+// runqueue_charge(p)
+//    Charge process `p` for a timer tick of CPU time.
+
+static void runqueue_charge(proc* p) {
+    ++p->p_runtime;
+    p->p_vruntime += VRUNTIME_TICK / nice_weights[p->p_nice - NICE_MIN];
+    runqueue_sift(p->p_rqindex);
+}
+
+// runqueue_yield(p)
+//    Move process `p`, which is yielding the CPU, behind the next process
+//    in the run queue, so that one runs next. Its virtual runtime grows
+//    only as far as needed to do that.
+
+static void runqueue_yield(proc* p) {
+    if (p->p_rqindex != 0 || nrunqueue < 2)
+        return;
+    proc* next = runqueue[1];
+    if (nrunqueue > 2 && runqueue_less(runqueue[2], next))
+        next = runqueue[2];
+    if (p->p_vruntime <= next->p_vruntime)
+        p->p_vruntime = next->p_vruntime + 1;
+    runqueue_sift(0);
+}
+
+
 // exception(reg)
 //    Exception handler (for interrupts, traps, and faults).
 //
@@ -230,27 +711,80 @@ void exception(x86_64_registers* reg) {
         break;
 
     case INT_SYS_YIELD:
+        runqueue_yield(current);
         schedule();
         break;                  /* will not be reached */
 
     case INT_SYS_PAGE_ALLOC: {
         uintptr_t addr = current->p_registers.reg_rdi;
-        int r = assign_physical_page(addr, current->p_pid);
-        if (r >= 0)
-            virtual_memory_map(current->p_pagetable, addr, addr,
-                               PAGESIZE, PTE_P | PTE_W | PTE_U, NULL);
+        int r = -1;
+        uintptr_t pa;
+        if (addr % PAGESIZE == 0
+            && addr >= PROC_START_ADDR
+            && addr < current->p_stack_limit - PAGESIZE
+            && (pa = kalloc_page(current->p_pid))) {
+            vamapping old = virtual_memory_lookup(current->p_pagetable, addr);
+            global_owner = current->p_pid;
+            r = virtual_memory_map(current->p_pagetable, addr, pa,
+                                   PAGESIZE, PTE_P | PTE_W | PTE_U, alloc);
+            if (r < 0)
+                kfree_page(pa);
+            else {
+                memset((void*) pa, 0, PAGESIZE);
+                if (old.pn >= 0)
+                    kfree_page(PAGEADDRESS(old.pn));
+            }
+        }
+        current->p_registers.reg_rax = r;
+        break;
+    }
+
+    case INT_SYS_FORK:
+        current->p_registers.reg_rax = process_fork(current);
+        break;
+
+    case INT_SYS_EXIT:
+        process_exit(current);
+        break;
+
+    case INT_SYS_MAP_LAZY:
+        current->p_registers.reg_rax =
+            process_map_lazy(current, current->p_registers.reg_rdi,
+                             current->p_registers.reg_rsi);
+        break;
+
+    case INT_SYS_SETPRIORITY: {
+        // A process may only change its own priority.
+        pid_t pid = current->p_registers.reg_rdi;
+        int nice = current->p_registers.reg_rsi;
+        int r = -1;
+        if ((pid == 0 || pid == current->p_pid)
+            && nice >= NICE_MIN && nice <= NICE_MAX) {
+            current->p_nice = nice;
+            r = 0;
+        }
         current->p_registers.reg_rax = r;
         break;
     }
 
     case INT_TIMER:
         ++ticks;
+        if (current->p_state == P_RUNNABLE)
+            runqueue_charge(current);
         schedule();
         break;                  /* will not be reached */
 
     case INT_PAGEFAULT: {
         // Analyze faulting address and access type.
         uintptr_t addr = rcr2();
+        if ((reg->reg_err & (PFERR_USER | PFERR_WRITE | PFERR_PRESENT))
+               == (PFERR_USER | PFERR_WRITE | PFERR_PRESENT)
+            && cow_fault(current, addr) == 0)
+            break;
+        if ((reg->reg_err & (PFERR_USER | PFERR_PRESENT)) == PFERR_USER
+            && (lazy_fault(current, addr) == 0
+                || stack_fault(current, addr) == 0))
+            break;
         const char* operation = reg->reg_err & PFERR_WRITE
                 ? "write" : "read";
         const char* problem = reg->reg_err & PFERR_PRESENT
@@ -262,6 +796,7 @@ void exception(x86_64_registers* reg) {
         console_printf(CPOS(24, 0), 0x0C00,
                        "Process %d page fault for %p (%s %s, rip=%p)!\n",
                        current->p_pid, addr, operation, problem, reg->reg_rip);
+        runqueue_remove(current);
         current->p_state = P_BROKEN;
         break;
     }
@@ -282,15 +817,14 @@ void exception(x86_64_registers* reg) {
 
 
 // schedule
-//    Pick the next process to run and then run it.
+//    Pick the next process to run and then run it: the runnable process
+//    with the least virtual runtime, which is the head of the run queue.
 //    If there are no runnable processes, spins forever.
 
 void schedule(void) {
-    pid_t pid = current->p_pid;
     while (1) {
-        pid = (pid + 1) % NPROC;
-        if (processes[pid].p_state == P_RUNNABLE)
-            run(&processes[pid]);
+        if (nrunqueue > 0)
+            run(runqueue[0]);
         // If Control-C was typed, exit the virtual machine.
         check_keyboard();
     }
@@ -318,11 +852,14 @@ void run(proc* p) {
 
 
 // pageinfo_init
-//    Initialize the `pageinfo[]` array.
+//    Initialize the `pageinfo[]` array and the buddy allocator's free
+//    lists.
 
 void pageinfo_init(void) {
     extern char end[];
 
+    memset(freelists, 0, sizeof(freelists));
+    memset(nfreeblocks, 0, sizeof(nfreeblocks));
     for (uintptr_t addr = 0; addr < MEMSIZE_PHYSICAL; addr += PAGESIZE) {
         int owner;
         if (physical_memory_isreserved(addr))
@@ -334,6 +871,9 @@ void pageinfo_init(void) {
             owner = PO_FREE;
         pageinfo[PAGENUMBER(addr)].owner = owner;
         pageinfo[PAGENUMBER(addr)].refcount = (owner != PO_FREE);
+        pageinfo[PAGENUMBER(addr)].order = -1;
+        if (owner == PO_FREE)
+            buddy_release(PAGENUMBER(addr), 0);
     }
 }
 
@@ -460,6 +1000,12 @@ void memshow_physical(void) {
 
         console[CPOS(1 + pn / 64, 12 + pn % 64)] = color;
     }
+
+    // free buddy blocks of each order, to show fragmentation
+    int cpos = console_printf(CPOS(9, 3), 0x0F00, "FREE BLKS");
+    for (int order = 0; order <= MAXORDER; ++order)
+        cpos = console_printf(cpos, 0x0700, " %d:%-3d",
+                              order, nfreeblocks[order]);
 }
 
 
@@ -18,16 +18,43 @@ typedef enum procstate {
     P_BROKEN                            // faulted process
 } procstate_t;
 
+// Virtual address range `[start, end)`; empty if `start == end`
+typedef struct vmregion {
+    uintptr_t start;
+    uintptr_t end;
+} vmregion;
+
+#define NLAZYREGIONS 4          // demand-zero regions per process
+
 // Process descriptor type
 typedef struct proc {
     pid_t p_pid;                        // process ID
     x86_64_registers p_registers;       // process's current registers
     procstate_t p_state;                // process state (see above)
     x86_64_pagetable* p_pagetable;      // process's page table
+    vmregion p_lazy[NLAZYREGIONS];      // demand-zero regions
+    uintptr_t p_stack_bottom;           // lowest mapped stack address
+    uintptr_t p_stack_limit;            // stack may not grow below this;
+                                        // the page below is a guard page
+    unsigned p_runtime;                 // timer ticks spent running
+    uint64_t p_vruntime;                // runtime scaled by weight; the
+                                        // runnable process with the least
+                                        // runs next
+    int p_nice;                         // priority: NICE_MIN (most CPU)
+                                        // to NICE_MAX (least CPU)
+    int p_rqindex;                      // index in run queue, or -1
 } proc;
 
+#define NICE_MIN (-20)
+#define NICE_MAX 19
+
 #define NPROC 16                // maximum number of processes
 
+// Software page table entry bits (AVAIL bits 9-11; the processor ignores
+// them)
+#define PTE_COW ((x86_64_pageentry_t) 0x200)    // read-only until written,
+                                                // then copied
+
 
 // Kernel start address
 #define KERNEL_START_ADDR       0x40000
@@ -45,6 +72,10 @@ typedef struct proc {
 // Virtual memory size
 #define MEMSIZE_VIRTUAL         0x300000
 
+// Largest process stack; stacks start with one page at the top of
+// virtual memory and grow down on demand
+#define STACK_MAXSIZE           0x10000
+
 // Hardware interrupt numbers
 #define INT_HARDWARE            32
 #define INT_TIMER               (INT_HARDWARE + 0)
@@ -99,12 +130,62 @@ typedef struct vamapping {
 
 vamapping virtual_memory_lookup(x86_64_pagetable* pagetable, uintptr_t va);
 
+// pagetable_clone(dst, src, start, end, allocator, clone_entry)
+//    Copy the mappings of `src` for virtual addresses in `[start, end)`
+//    into `dst`, walking the page table tree level by level and skipping
+//    subtrees with no mappings. Missing page tables in `dst` are taken
+//    from `allocator`. Each present level-4 entry of `src` is copied
+//    as is, or, if `clone_entry` is nonnull, replaced by
+//    `clone_entry(va, &src_entry)` (which may also modify the source
+//    entry). Returns 0 on success and -1 if a page table could not be
+//    allocated, in which case `dst` holds a partial copy.
+int pagetable_clone(x86_64_pagetable* dst, x86_64_pagetable* src,
+                    uintptr_t start, uintptr_t end,
+                    x86_64_pagetable* (*allocator)(void),
+                    x86_64_pageentry_t (*clone_entry)(uintptr_t va,
+                                                      x86_64_pageentry_t* pe));
+
+// pagetable_walk(pagetable, start, end, fn)
+//    Call `fn(va, &entry)` for each present level-4 entry of `pagetable`
+//    mapping a virtual address in `[start, end)`, skipping subtrees with
+//    no mappings.
+void pagetable_walk(x86_64_pagetable* pagetable, uintptr_t start,
+                    uintptr_t end,
+                    void (*fn)(uintptr_t va, x86_64_pageentry_t* pe));
+
+// pagetable_free(pagetable, start, end, release)
+//    Call `release(pa)` for the physical page of each mapping of a virtual
+//    address in `[start, end)`, then for every page table page of
+//    `pagetable`, including `pagetable` itself.
+void pagetable_free(x86_64_pagetable* pagetable, uintptr_t start,
+                    uintptr_t end, void (*release)(uintptr_t pa));
+
 // assign_physical_page(addr, owner)
 //    Assigns the page with physical address `addr` to the given owner.
 //    Fails if physical page `addr` was already allocated. Returns 0 on
-//    success and -1 on failure. Used by the program loader.
+//    success and -1 on failure.
 int assign_physical_page(uintptr_t addr, int8_t owner);
 
+// kalloc_page(owner)
+//    Allocates a free physical page for `owner` and returns its address,
+//    or 0 if physical memory is exhausted. Same as `kalloc_pages(0, owner)`:
+//    if no single page is free, a larger buddy block is split, which takes
+//    up to 9 halving steps.
+uintptr_t kalloc_page(int8_t owner);
+
+// kfree_page(pa)
+//    Drops a reference to the physical page at `pa`; the page is freed
+//    when its reference count reaches 0.
+void kfree_page(uintptr_t pa);
+
+// kalloc_pages(order, owner), kfree_pages(pa, order)
+//    Like `kalloc_page` and `kfree_page`, but for a block of 2^`order`
+//    physically contiguous pages (0 <= `order` <= 9), aligned to its size.
+//    Both take O(log NPAGES) time plus time to update each page's
+//    pageinfo entry.
+uintptr_t kalloc_pages(int order, int8_t owner);
+void kfree_pages(uintptr_t pa, int order);
+
 // physical_memory_isreserved(pa)
 //    Returns non-zero iff `pa` is a reserved physical address.
 int physical_memory_isreserved(uintptr_t pa);
@@ -160,9 +241,10 @@ int keyboard_readc(void);
 #define KEY_DELETE      0311
 
 // check_keyboard
-//    Check for the user typing a control key. 'a', 'f', and 'e' cause a soft
-//    reboot where the kernel runs the allocator programs, "fork", or
-//    "forkexit", respectively. Control-C or 'q' exit the virtual machine.
+//    Check for the user typing a control key. 'a', 'f', 'e', 'l', and 'n'
+//    cause a soft reboot where the kernel runs the allocator programs,
+//    "fork", "forkexit", the demand-zero allocators, or the niced CPU hogs,
+//    respectively. Control-C or 'q' exit the virtual machine.
 //    Returns key typed or -1 for no key.
 int check_keyboard(void);
 
@@ -179,7 +261,7 @@ void process_init(proc* p, int flags);
 // program_load(p, programnumber)
 //    Load the code corresponding to program `programnumber` into the process
 //    `p` and set `p->p_registers.reg_eip` to its entry point. Calls
-//    `assign_physical_page` as required. Returns 0 on success and
+//    `kalloc_page` as required. Returns 0 on success and
 //    -1 on failure (e.g. out-of-memory). `allocator` is passed to
 //    `virtual_memory_map`.
 int program_load(proc* p, int programnumber,
@@ -100,6 +100,8 @@ void panic(const char* format, ...) __attribute__((noinline, noreturn));
 #define INT_SYS_PAGE_ALLOC      (INT_SYS + 3)
 #define INT_SYS_FORK            (INT_SYS + 4)
 #define INT_SYS_EXIT            (INT_SYS + 5)
+#define INT_SYS_MAP_LAZY        (INT_SYS + 6)
+#define INT_SYS_SETPRIORITY     (INT_SYS + 7)
 
 
 // Console printing
@@ -18,7 +18,9 @@ void process_main(void) {
     heap_top = ROUNDUP((uint8_t*) end, PAGESIZE);
 
     // The bottom of the stack is the first address on the current
-    // stack page (this process never needs more than one stack page).
+    // stack page. The kernel grows the stack below this on demand and
+    // reserves room for it, so sys_page_alloc fails before the heap
+    // reaches the stack.
     stack_bottom = ROUNDDOWN((uint8_t*) read_rsp() - 1, PAGESIZE);
 
     // Allocate heap pages until (1) hit the stack (out of address space)
@@ -0,0 +1,39 @@
+#include "process.h"
+#include "lib.h"
+#define ALLOC_SLOWDOWN 100
+#define HEAP_SIZE 0x20000       // 32 pages each, so four heaps fit in memory
+
+extern uint8_t end[];
+
+// These global variables go on the data page.
+uint8_t* heap_top;
+uint8_t* heap_end;
+
+void process_main(void) {
+    pid_t p = sys_getpid();
+    srand(p);
+
+    // The heap starts on the page right after the 'end' symbol,
+    // whose address is the first address not allocated to process code
+    // or data. Unlike p-allocator, this process makes its whole heap a
+    // demand-zero region with one system call; the kernel allocates
+    // each page when it is first touched.
+    heap_top = ROUNDUP((uint8_t*) end, PAGESIZE);
+    heap_end = heap_top + HEAP_SIZE;
+    int r = sys_map_lazy(heap_top, HEAP_SIZE);
+    assert(r == 0);
+
+    // Grow the heap by touching pages until it is all mapped.
+    while (heap_top != heap_end) {
+        if ((rand() % ALLOC_SLOWDOWN) < p) {
+            assert(*heap_top == 0);     /* demand-zero pages start zeroed */
+            *heap_top = p;              /* fault the page in */
+            heap_top += PAGESIZE;
+        }
+        sys_yield();
+    }
+
+    // After filling the heap, do nothing forever
+    while (1)
+        sys_yield();
+}
@@ -0,0 +1,28 @@
+#include "process.h"
+#include "lib.h"
+#define NICE_STEP 5
+#define REPORT_INTERVAL 0x10000
+
+// Each process is a CPU hog with nice value (pid - 1) * NICE_STEP, so
+// processes 1-4 run at nice 0, 5, 10, and 15. They never yield, so the
+// scheduler splits the CPU by weight, about 1024:335:110:36, and the
+// counts shown on the bottom line of the console grow in that ratio.
+
+void process_main(void) {
+    pid_t p = sys_getpid();
+    int nice = (p - 1) * NICE_STEP;
+
+    // A process may renice itself, by pid or as 0, but nobody else.
+    int r = sys_setpriority(p == 1 ? 0 : p, nice);
+    assert(r == 0);
+    r = sys_setpriority(p == 1 ? 2 : 1, NICE_STEP);
+    assert(r == -1);
+
+    unsigned long count = 0;
+    while (1) {
+        ++count;
+        if (count % REPORT_INTERVAL == 0)
+            console_printf(CPOS(23, (p - 1) * 20), 0x0700,
+                           "nice %2d: %8lu", nice, count / REPORT_INTERVAL);
+    }
+}
@@ -44,6 +44,35 @@ static inline int sys_page_alloc(void* addr) {
     return result;
 }
 
+// sys_map_lazy(addr, sz)
+//    Make `[addr, addr+sz)` a demand-zero region: each page in it is
+//    allocated and zero-filled by the kernel the first time it is touched,
+//    without further system calls. `addr` and `sz` must be multiples of
+//    PAGESIZE. Returns 0 on success and -1 on failure (bad range or too
+//    many regions).
+static inline int sys_map_lazy(void* addr, size_t sz) {
+    int result;
+    asm volatile ("int %1" : "=a" (result)
+                  : "i" (INT_SYS_MAP_LAZY), "D" /* %rdi */ (addr),
+                    "S" /* %rsi */ (sz)
+                  : "cc", "memory");
+    return result;
+}
+
+// sys_setpriority(pid, nice)
+//    Set the nice value of the calling process to `nice`, between -20 and
+//    19. `pid` must be 0 or the caller's own pid. Each step up in nice
+//    gives a CPU-bound process about 20% less CPU time relative to others.
+//    Returns 0 on success and -1 on failure.
+static inline int sys_setpriority(pid_t pid, int nice) {
+    int result;
+    asm volatile ("int %1" : "=a" (result)
+                  : "i" (INT_SYS_SETPRIORITY), "D" /* %rdi */ (pid),
+                    "S" /* %rsi */ (nice)
+                  : "cc", "memory");
+    return result;
+}
+
 // sys_fork()
 //    Fork the current process. On success, return the child's process ID to
 //    the parent, and return 0 to the child. On failure, return -1.